@@ -0,0 +1,193 @@
+// bench.cpp --- measures the fill search on fixed grids
+//    ex) bench dict.txt 64 > bench_output.txt
+// Fills each grid with and without conflict-directed backjumping and prints
+// the levels jumped and the time, then fills it on 1, 2, 4, ... threads and
+// prints the speedup, then compares the throughput of a batch with one
+// puzzle at a time.
+
+#include "crossword_generation.hpp"
+#include "load_dict.hpp"
+#include <chrono>
+
+struct grid_t {
+    const char *m_name;
+    int m_cx, m_cy;
+    const char *m_data;
+};
+
+// the 6x6 and 8x8 grids have solutions in dict.txt. the 10x10 grid has none,
+// so it measures the whole tree.
+static const grid_t s_grids[] = {
+    { "6x6", 6, 6,
+        "?????#"
+        "?#?#?#"
+        "?#????"
+        "????#?"
+        "#?#?#?"
+        "#?????" },
+    { "8x8", 8, 8,
+        "???#????"
+        "???#????"
+        "????#???"
+        "##???###"
+        "???????#"
+        "???#????"
+        "????#???"
+        "????#???" },
+    { "10x10", 10, 10,
+        "?????#????"
+        "?????#????"
+        "?????#????"
+        "????#?????"
+        "###???##??"
+        "??##???###"
+        "?????#????"
+        "????#?????"
+        "????#?????"
+        "????#?????" },
+};
+
+static void
+bench_backjump(std::shared_ptr<const crossword_generation::dictionary_t<char> > dict)
+{
+    using namespace crossword_generation;
+
+    // one thread, so that the jumps and the time come from the same tree
+    std::printf("%-6s %9s %8s %6s %10s %10s\n",
+                "grid", "lookahead", "backjump", "solved", "jumps", "msec");
+    for (auto& grid : s_grids) {
+        board_t<char, true> board(grid.m_cx, grid.m_cy, '?');
+        board.m_data = grid.m_data;
+        auto graph = std::make_shared<const slot_graph_t>(board);
+
+        for (int lookahead : { int(LOOKAHEAD::FORWARD), int(LOOKAHEAD::AC3) }) {
+            for (bool backjump : { false, true }) {
+                strategy_t strategy;
+                strategy.m_seed = 1;
+                strategy.m_lookahead = lookahead;
+                strategy.m_backjump = backjump;
+                non_add_block_t<char>::context_t context;
+                auto t0 = std::chrono::steady_clock::now();
+                bool solved = non_add_block_t<char>::generate_proc(
+                    &context, new board_t<char, true>(board), graph, dict, 0, strategy, 0,
+                    nullptr);
+                auto t1 = std::chrono::steady_clock::now();
+                double msec = std::chrono::duration<double, std::milli>(t1 - t0).count();
+                std::printf("%-6s %9s %8s %6s %10lld %10.1f\n", grid.m_name,
+                            (lookahead == LOOKAHEAD::AC3) ? "AC3" : "FORWARD",
+                            backjump ? "on" : "off", solved ? "yes" : "no",
+                            (long long)context.m_jumped, msec);
+            }
+        }
+    }
+}
+
+static void
+bench_scaling(std::shared_ptr<const crossword_generation::dictionary_t<char> > dict,
+              int max_threads)
+{
+    using namespace crossword_generation;
+    const int REPEAT = 3;
+
+    std::printf("%-6s %7s %6s %10s %8s\n", "grid", "threads", "solved", "msec", "speedup");
+    for (auto& grid : s_grids) {
+        board_t<char, true> board(grid.m_cx, grid.m_cy, '?');
+        board.m_data = grid.m_data;
+
+        double base = 0;
+        for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+            int solved = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < REPEAT; ++i) {
+                strategy_t strategy;
+                strategy.m_seed = i + 1;
+                non_add_block_t<char>::context_t context;
+                non_add_block_t<char>::do_generate(context, board, dict, num_threads, strategy);
+                context.join();
+                if (context.is_generated())
+                    ++solved;
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            double msec = std::chrono::duration<double, std::milli>(t1 - t0).count() / REPEAT;
+            if (num_threads == 1)
+                base = msec;
+            std::printf("%-6s %7d %3d/%-2d %10.1f %8.2f\n", grid.m_name, num_threads,
+                        solved, REPEAT, msec, base / msec);
+        }
+    }
+}
+
+// the throughput of the solvable grids, one puzzle after another and as a batch.
+// neither mode uses a nogood table, so both pay the same per puzzle.
+static void
+bench_batch(std::shared_ptr<const crossword_generation::dictionary_t<char> > dict,
+            int max_threads)
+{
+    using namespace crossword_generation;
+
+    const int BATCH = 64;
+    int num_threads = std::min(max_threads, int(get_num_processors()));
+    std::printf("%-10s %7s %6s %10s %10s\n", "mode", "threads", "solved", "msec", "puzzles/s");
+    for (int mode = 0; mode < 2; ++mode) {
+        int solved = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        if (mode == 0) {
+            for (int i = 0; i < BATCH; ++i) {
+                auto& grid = s_grids[i % 2];
+                board_t<char, true> board(grid.m_cx, grid.m_cy, '?');
+                board.m_data = grid.m_data;
+                strategy_t strategy;
+                strategy.m_seed = i + 1;
+                non_add_block_t<char>::context_t context;
+                non_add_block_t<char>::do_generate(context, board, dict, 1, strategy);
+                if (context.wait())
+                    ++solved;
+            }
+        } else {
+            batch_t<char> batch(num_threads);
+            for (int i = 0; i < BATCH; ++i) {
+                auto& grid = s_grids[i % 2];
+                batch_t<char>::job_t job;
+                job.m_board = board_t<char, true>(grid.m_cx, grid.m_cy, '?');
+                job.m_board.m_data = grid.m_data;
+                job.m_dict = dict;
+                job.m_strategy.m_seed = i + 1;
+                batch.submit(std::move(job));
+            }
+            batch_t<char>::result_t result;
+            while (batch.get_result(result)) {
+                if (result.m_generated)
+                    ++solved;
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        double msec = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        std::printf("%-10s %7d %3d/%-2d %10.1f %10.1f\n", (mode ? "batch" : "sequential"),
+                    (mode ? num_threads : 1), solved, BATCH, msec, BATCH * 1000.0 / msec);
+    }
+}
+
+int main(int argc, char **argv) {
+    using namespace crossword_generation;
+
+    const char *filename = (argc > 1) ? argv[1] : "dict.txt";
+    int max_threads = (argc > 2) ? std::atoi(argv[2]) : 64;
+
+    std::unordered_set<std::string> words;
+    auto dict = dictionary_t<char>::load(filename);
+    if (!dict) {
+        if (!load_dict(filename, words)) {
+            std::fprintf(stderr, "ERROR: cannot load file '%s'\n", filename);
+            return EXIT_FAILURE;
+        }
+        dict = std::make_shared<const dictionary_t<char> >(words);
+    }
+
+    bench_backjump(dict);
+    std::printf("\n");
+    bench_scaling(dict, max_threads);
+    std::printf("\n");
+    bench_batch(dict, max_threads);
+
+    return 0;
+}
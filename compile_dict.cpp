@@ -0,0 +1,30 @@
+// compile_dict.cpp --- compiles a text dictionary into a binary dictionary
+//    ex) compile_dict dict.txt dict.bin
+// The generator can memory-map the output file by dictionary_t::load.
+
+#include "crossword_generation.hpp"
+#include "load_dict.hpp"
+
+int main(int argc, char **argv) {
+    using namespace crossword_generation;
+
+    if (argc != 3) {
+        std::fprintf(stderr, "Usage: compile_dict input.txt output.bin\n");
+        return EXIT_FAILURE;
+    }
+
+    std::unordered_set<std::string> words;
+    if (!load_dict(argv[1], words)) {
+        std::fprintf(stderr, "ERROR: cannot load file '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    dictionary_t<char> dict(words);
+    if (!dict.save(argv[2])) {
+        std::fprintf(stderr, "ERROR: cannot write file '%s'\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%d words, %u bytes\n", dict.size(), unsigned(dict.m_image_size));
+    return 0;
+}
@@ -2,7 +2,9 @@
 
 #define CROSSWORD_GENERATION 23 // crossword_generation version
 
-#define _GNU_SOURCE
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
 #include <cstdio>
 #include <cstdint>
 #include <ctime>
@@ -12,15 +14,31 @@
 #include <unordered_map>
 #include <queue>
 #include <thread>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
 #include <algorithm>
+#include <cmath>
 #include <utility>
 #include <random>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <array>
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
 #ifdef _WIN32
     #include <windows.h>
 #else
     #include <unistd.h>
+    #include <fcntl.h>
     #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
     inline uint64_t GetTickCount64(void) {
         using namespace std;
         struct timespec ts;
@@ -55,9 +73,6 @@ namespace std {
 } // namespace std
 
 namespace crossword_generation {
-inline static bool s_generated = false;
-inline static bool s_canceled = false;
-inline static std::mutex s_mutex;
 
 struct RULES {
     enum {
@@ -73,6 +88,135 @@ struct RULES {
     };
 };
 
+struct MATCHER {
+    enum {
+        BITSET, // intersects the positional letter bitsets
+        TRIE,   // descends the trie
+    };
+};
+
+struct LOOKAHEAD {
+    enum {
+        NONE,    // checks the crossing slots after each placement
+        FORWARD, // prunes the domains of the crossing slots
+        AC3,     // propagates the pruning until arc consistent
+    };
+};
+
+struct SLOT_ORDER {
+    enum {
+        ROW_MAJOR, // the first partial slot, across then down
+        MRV,       // the slot with the fewest candidates, then the most crossings
+    };
+};
+
+struct VALUE_ORDER {
+    enum {
+        RANDOM, // shuffles the candidates
+        LCV,    // the least constraining candidates first, shuffled among equals
+    };
+};
+
+struct RESTART {
+    enum {
+        NONE,
+        LUBY,      // the budgets follow the Luby sequence 1, 1, 2, 1, 1, 2, 4, ...
+        GEOMETRIC, // each budget is 1.5 times the previous one
+    };
+};
+
+// the i-th term of the Luby sequence (i >= 1)
+inline long long luby(long long i) {
+    for (;;) {
+        int k = 1;
+        while ((1LL << k) - 1 < i)
+            ++k;
+        if (i == (1LL << k) - 1)
+            return 1LL << (k - 1);
+        i -= (1LL << (k - 1)) - 1;
+    }
+}
+
+struct nogood_table_t;
+
+// the search strategy of the generators.
+// from_words_t uses m_value_order, m_seed, m_nogoods and the restarts only.
+struct strategy_t {
+    int m_matcher;
+    int m_lookahead;
+    int m_slot_order;
+    int m_value_order;
+    bool m_backjump; // conflict-directed backjumping. needs a lookahead.
+    uint32_t m_seed; // 0 for a random seed
+    // the nogood table shared by the threads, or null to disable.
+    // the caller owns it and may reuse it across the calls.
+    std::shared_ptr<nogood_table_t> m_nogoods;
+    int m_restart;
+    long long m_restart_base; // the nodes of the first budget
+    bool m_portfolio; // the threads vary the strategy. no work stealing.
+    int m_rules; // the RULES that from_words_t keeps while placing words
+
+    strategy_t()
+        : m_matcher(MATCHER::BITSET)
+        , m_lookahead(LOOKAHEAD::AC3)
+        , m_slot_order(SLOT_ORDER::MRV)
+        , m_value_order(VALUE_ORDER::RANDOM)
+        , m_backjump(false)
+        , m_seed(0)
+        , m_restart(RESTART::NONE)
+        , m_restart_base(256)
+        , m_portfolio(false)
+        , m_rules(0)
+    {
+    }
+
+    // the seed of the iThread-th thread
+    uint32_t get_seed(int iThread) const {
+        if (m_seed)
+            return m_seed + uint32_t(iThread);
+        std::random_device rd;
+        return rd();
+    }
+
+    // the node budget of the irestart-th run (irestart >= 1). -1 for no limit.
+    long long get_budget(int irestart) const {
+        switch (m_restart) {
+        case RESTART::LUBY:
+            return m_restart_base * luby(irestart);
+        case RESTART::GEOMETRIC:
+            {
+                double budget = double(m_restart_base) * std::pow(1.5, irestart - 1);
+                return (budget < 1e18) ? (long long)budget : -1;
+            }
+        default:
+            return -1;
+        }
+    }
+
+    // the strategy of the iThread-th thread
+    strategy_t get_variant(int iThread) const {
+        strategy_t ret = *this;
+        if (!m_portfolio)
+            return ret;
+        switch (iThread % 4) {
+        case 1:
+            ret.m_value_order = VALUE_ORDER::LCV;
+            break;
+        case 2:
+            ret.m_value_order = VALUE_ORDER::LCV;
+            ret.m_lookahead = LOOKAHEAD::FORWARD;
+            if (ret.m_restart == RESTART::NONE)
+                ret.m_restart = RESTART::GEOMETRIC; // from_words_t ignores the lookahead
+            break;
+        case 3:
+            if (ret.m_restart == RESTART::NONE)
+                ret.m_restart = RESTART::LUBY;
+            break;
+        }
+        return ret;
+    }
+};
+
 template <typename t_char>
 inline bool is_letter(t_char ch) {
     return (ch != '#' && ch != '?');
@@ -90,88 +234,1276 @@ inline uint32_t get_num_processors(void) {
 #endif
 }
 
-// replacement of std::random_shuffle
-template <typename t_elem>
-inline void random_shuffle(const t_elem& begin, const t_elem& end) {
-#ifndef NO_RANDOM
-    std::random_device rd;
-    std::mt19937 g(rd());
-    std::shuffle(begin, end, g);
-#endif
-}
+// replacement of std::random_shuffle
+template <typename t_elem>
+inline void random_shuffle(const t_elem& begin, const t_elem& end) {
+#ifndef NO_RANDOM
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::shuffle(begin, end, g);
+#endif
+}
+template <typename t_elem, typename t_rng>
+inline void random_shuffle(const t_elem& begin, const t_elem& end, t_rng& rng) {
+#ifndef NO_RANDOM
+    std::shuffle(begin, end, rng);
+#endif
+}
+
+
+// disjoint-set forest
+struct union_find_t {
+    std::vector<int> m_parent;
+
+    union_find_t(size_t count = 0) : m_parent(count) {
+        for (size_t i = 0; i < count; ++i)
+            m_parent[i] = int(i);
+    }
+
+    int find(int i) {
+        while (m_parent[i] != i) {
+            m_parent[i] = m_parent[m_parent[i]];
+            i = m_parent[i];
+        }
+        return i;
+    }
+
+    bool unite(int i, int j) {
+        i = find(i);
+        j = find(j);
+        if (i == j)
+            return false;
+        if (i < j)
+            m_parent[j] = i;
+        else
+            m_parent[i] = j;
+        return true;
+    }
+};
+
+// connects the words sharing a letter. O(total length of the words).
+template <typename t_char>
+inline void
+connect_words(const std::vector<std::basic_string<t_char> >& vec_words, union_find_t& uf)
+{
+    std::unordered_map<t_char, int> buckets; // letter --> the first word having it
+    for (size_t index = 0; index < vec_words.size(); ++index) {
+        for (auto ch : vec_words[index]) {
+            auto pair = buckets.emplace(ch, int(index));
+            if (!pair.second)
+                uf.unite(pair.first->second, int(index));
+        }
+    }
+}
+
+template <typename t_char>
+inline bool
+check_connectivity(const std::unordered_set<std::basic_string<t_char> >& words,
+                   std::basic_string<t_char>& nonconnected)
+{
+    typedef std::basic_string<t_char> t_string;
+    if (words.size() <= 1)
+        return true;
+
+    std::vector<t_string> vec_words(words.begin(), words.end());
+    union_find_t uf(vec_words.size());
+    connect_words(vec_words, uf);
+
+    int root = uf.find(0);
+    for (size_t i = 0; i < vec_words.size(); ++i) {
+        if (uf.find(int(i)) != root) {
+            nonconnected = vec_words[i];
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// the groups of the words connected by shared letters.
+// The words are connected if the result has one group.
+template <typename t_char>
+inline std::vector<std::vector<std::basic_string<t_char> > >
+get_components(const std::unordered_set<std::basic_string<t_char> >& words)
+{
+    typedef std::basic_string<t_char> t_string;
+    std::vector<std::vector<t_string> > ret;
+
+    std::vector<t_string> vec_words(words.begin(), words.end());
+    union_find_t uf(vec_words.size());
+    connect_words(vec_words, uf);
+
+    std::unordered_map<int, size_t> groups; // root --> index of ret
+    for (size_t i = 0; i < vec_words.size(); ++i) {
+        auto pair = groups.emplace(uf.find(int(i)), ret.size());
+        if (pair.second)
+            ret.emplace_back();
+        ret[pair.first->second].push_back(vec_words[i]);
+    }
+
+    return ret;
+}
+
+template <typename t_char>
+inline void connectivity_unittest() {
+#ifndef NDEBUG
+    typedef std::basic_string<t_char> t_string;
+    std::unordered_set<t_string> words;
+    for (auto word : { "CAT", "TEA", "ACE", "DOG", "GOD", "XYZ" }) {
+        words.insert(t_string(word, word + std::char_traits<char>::length(word)));
+    }
+
+    t_string nonconnected;
+    assert(!check_connectivity(words, nonconnected));
+    assert(words.count(nonconnected) == 1);
+
+    // { CAT, TEA, ACE }, { DOG, GOD } and { XYZ }
+    auto components = get_components(words);
+    assert(components.size() == 3);
+    std::vector<size_t> sizes;
+    size_t total = 0;
+    for (auto& component : components) {
+        std::sort(component.begin(), component.end());
+        sizes.push_back(component.size());
+        total += component.size();
+        if (component.size() == 2)
+            assert(component[0][0] == 'D' && component[1][0] == 'G');
+    }
+    std::sort(sizes.begin(), sizes.end());
+    assert(sizes[0] == 1 && sizes[1] == 2 && sizes[2] == 3 && total == words.size());
+
+    // the witness is outside the component of another word
+    bool found = false;
+    for (auto& component : components) {
+        if (std::find(component.begin(), component.end(), nonconnected) != component.end())
+            found = (component.size() < words.size());
+    }
+    assert(found);
+
+    for (auto word : { "DOG", "GOD", "XYZ" }) {
+        words.erase(t_string(word, word + std::char_traits<char>::length(word)));
+    }
+    assert(check_connectivity(words, nonconnected));
+    assert(get_components(words).size() == 1);
+#endif
+}
+
+inline int popcount64(uint64_t value) {
+#ifdef _MSC_VER
+    return int(__popcnt64(value));
+#else
+    return __builtin_popcountll(value);
+#endif
+}
+
+inline int ctz64(uint64_t value) {
+    assert(value != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return int(index);
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+inline uint64_t reverse_bits64(uint64_t value) {
+    value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+    value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    value = ((value >> 8) & 0x00FF00FF00FF00FFULL) | ((value & 0x00FF00FF00FF00FFULL) << 8);
+    value = ((value >> 16) & 0x0000FFFF0000FFFFULL) | ((value & 0x0000FFFF0000FFFFULL) << 16);
+    return (value >> 32) | (value << 32);
+}
+
+// dynamic bitset
+struct bitset_t {
+    std::vector<uint64_t> m_bits;
+    size_t m_size;
+
+    bitset_t(size_t size = 0, bool value = false) : m_size(0) {
+        resize(size, value);
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    void resize(size_t size, bool value = false) {
+        m_size = size;
+        m_bits.assign((size + 63) / 64, value ? ~uint64_t(0) : 0);
+        if (value && (size & 63))
+            m_bits.back() = (uint64_t(1) << (size & 63)) - 1;
+    }
+
+    bool test(size_t i) const {
+        return (m_bits[i >> 6] >> (i & 63)) & 1;
+    }
+    void set(size_t i) {
+        m_bits[i >> 6] |= (uint64_t(1) << (i & 63));
+    }
+    void reset(size_t i) {
+        m_bits[i >> 6] &= ~(uint64_t(1) << (i & 63));
+    }
+
+    size_t count() const {
+        size_t ret = 0;
+        for (auto bits : m_bits)
+            ret += popcount64(bits);
+        return ret;
+    }
+    bool any() const {
+        for (auto bits : m_bits) {
+            if (bits)
+                return true;
+        }
+        return false;
+    }
+
+    bitset_t& operator&=(const bitset_t& other) {
+        assert(m_size == other.m_size);
+        for (size_t i = 0; i < m_bits.size(); ++i)
+            m_bits[i] &= other.m_bits[i];
+        return *this;
+    }
+    bitset_t& operator&=(const uint64_t *bits) {
+        for (size_t i = 0; i < m_bits.size(); ++i)
+            m_bits[i] &= bits[i];
+        return *this;
+    }
+    bitset_t& operator|=(const bitset_t& other) {
+        assert(m_size == other.m_size);
+        for (size_t i = 0; i < m_bits.size(); ++i)
+            m_bits[i] |= other.m_bits[i];
+        return *this;
+    }
+    bitset_t& operator|=(const uint64_t *bits) {
+        for (size_t i = 0; i < m_bits.size(); ++i)
+            m_bits[i] |= bits[i];
+        return *this;
+    }
+    size_t count_and(const uint64_t *bits) const {
+        size_t ret = 0;
+        for (size_t i = 0; i < m_bits.size(); ++i)
+            ret += popcount64(m_bits[i] & bits[i]);
+        return ret;
+    }
+    bool intersects(const uint64_t *bits) const {
+        for (size_t i = 0; i < m_bits.size(); ++i) {
+            if (m_bits[i] & bits[i])
+                return true;
+        }
+        return false;
+    }
+    bool operator==(const bitset_t& other) const {
+        return m_size == other.m_size && m_bits == other.m_bits;
+    }
+    bool operator!=(const bitset_t& other) const {
+        return !(*this == other);
+    }
+
+    // this = src[first, first + count)
+    void assign_range(const bitset_t& src, size_t first, size_t count) {
+        assert(first + count <= src.m_size);
+        resize(count);
+        size_t unit = first >> 6, shift = first & 63;
+        for (size_t i = 0; i < m_bits.size(); ++i, ++unit) {
+            uint64_t bits = src.m_bits[unit] >> shift;
+            if (shift && unit + 1 < src.m_bits.size())
+                bits |= src.m_bits[unit + 1] << (64 - shift);
+            m_bits[i] = bits;
+        }
+        if (count & 63)
+            m_bits.back() &= (uint64_t(1) << (count & 63)) - 1;
+    }
+
+    // calls fn(i) for each set bit i
+    template <typename t_fn>
+    void for_each(t_fn fn) const {
+        for (size_t i = 0; i < m_bits.size(); ++i) {
+            for (uint64_t bits = m_bits[i]; bits; bits &= bits - 1) {
+                fn((i << 6) + ctz64(bits));
+            }
+        }
+    }
+};
+
+// read-only array view
+template <typename T>
+struct span_t {
+    const T *m_data;
+    size_t m_size;
+
+    span_t(const T *data = nullptr, size_t size = 0) : m_data(data), m_size(size) { }
+
+    size_t size() const {
+        return m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+    const T *data() const {
+        return m_data;
+    }
+    const T *begin() const {
+        return m_data;
+    }
+    const T *end() const {
+        return m_data + m_size;
+    }
+    const T& operator[](size_t i) const {
+        assert(i < m_size);
+        return m_data[i];
+    }
+    const T& back() const {
+        assert(m_size > 0);
+        return m_data[m_size - 1];
+    }
+};
+
+// read-only memory-mapped file
+struct mapped_file_t {
+    const void *m_data;
+    size_t m_size;
+#ifdef _WIN32
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+#else
+    int m_fd;
+#endif
+
+    mapped_file_t() : m_data(nullptr), m_size(0) {
+#ifdef _WIN32
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_hMapping = nullptr;
+#else
+        m_fd = -1;
+#endif
+    }
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+    ~mapped_file_t() {
+        close();
+    }
+
+    bool open(const char *filename) {
+        close();
+#ifdef _WIN32
+        m_hFile = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_hFile == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0) {
+            close();
+            return false;
+        }
+        m_hMapping = ::CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_hMapping) {
+            close();
+            return false;
+        }
+        m_data = ::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        m_size = size_t(size.QuadPart);
+#else
+        m_fd = ::open(filename, O_RDONLY);
+        if (m_fd < 0)
+            return false;
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0 || st.st_size == 0) {
+            close();
+            return false;
+        }
+        void *data = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, m_fd, 0);
+        m_data = (data == MAP_FAILED) ? nullptr : data;
+        m_size = size_t(st.st_size);
+#endif
+        if (!m_data) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (m_data)
+            ::UnmapViewOfFile(m_data);
+        if (m_hMapping)
+            ::CloseHandle(m_hMapping);
+        if (m_hFile != INVALID_HANDLE_VALUE)
+            ::CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_hMapping = nullptr;
+#else
+        if (m_data)
+            ::munmap(const_cast<void *>(m_data), m_size);
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+};
+
+// dense grid of bits that grows on demand.
+// x, y: any coordinate. The bits outside the grid are zero.
+struct bitgrid_t {
+    int m_x0, m_y0; // the coordinate of the first bit
+    int m_cx, m_cy;
+    int m_stride;   // uint64_t's per row
+    int m_count;    // the number of the set bits
+    std::vector<uint64_t> m_bits;
+
+    bitgrid_t(int cx = 0, int cy = 0, int x0 = 0, int y0 = 0)
+        : m_x0(x0), m_y0(y0), m_cx(cx), m_cy(cy), m_stride((cx + 63) / 64), m_count(0)
+        , m_bits(size_t(m_stride) * cy, 0)
+    {
+    }
+
+    bool in_range(int x, int y) const {
+        return (m_x0 <= x && x < m_x0 + m_cx && m_y0 <= y && y < m_y0 + m_cy);
+    }
+
+    bool test(int x, int y) const {
+        if (!in_range(x, y))
+            return false;
+        x -= m_x0;
+        return (m_bits[size_t(y - m_y0) * m_stride + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    void set(int x, int y) {
+        ensure(x, y);
+        x -= m_x0;
+        uint64_t& bits = m_bits[size_t(y - m_y0) * m_stride + (x >> 6)];
+        uint64_t mask = (uint64_t(1) << (x & 63));
+        if (!(bits & mask)) {
+            bits |= mask;
+            ++m_count;
+        }
+    }
+    void reset(int x, int y) {
+        if (!in_range(x, y))
+            return;
+        x -= m_x0;
+        uint64_t& bits = m_bits[size_t(y - m_y0) * m_stride + (x >> 6)];
+        uint64_t mask = (uint64_t(1) << (x & 63));
+        if (bits & mask) {
+            bits &= ~mask;
+            --m_count;
+        }
+    }
+    void assign(int x, int y, bool value) {
+        if (value)
+            set(x, y);
+        else
+            reset(x, y);
+    }
+
+    bool empty() const {
+        return m_count == 0;
+    }
+
+    // grows the grid to contain (x, y) with some margin
+    void ensure(int x, int y) {
+        if (in_range(x, y))
+            return;
+        int margin = 8 + std::max(m_cx, m_cy) / 2;
+        int x0 = std::min(m_x0, x - margin), x1 = std::max(m_x0 + m_cx, x + margin + 1);
+        int y0 = std::min(m_y0, y - margin), y1 = std::max(m_y0 + m_cy, y + margin + 1);
+        if (m_cx == 0 || m_cy == 0) {
+            x0 = x - margin;
+            x1 = x + margin + 1;
+            y0 = y - margin;
+            y1 = y + margin + 1;
+        }
+        bitgrid_t grid(x1 - x0, y1 - y0, x0, y0);
+        for_each([&](int x2, int y2) {
+            grid.set(x2, y2);
+        });
+        *this = std::move(grid);
+    }
+
+    // calls fn(x, y) for each set bit
+    template <typename t_fn>
+    void for_each(t_fn fn) const {
+        for (int y = 0; y < m_cy; ++y) {
+            const uint64_t *row = &m_bits[size_t(y) * m_stride];
+            for (int i = 0; i < m_stride; ++i) {
+                for (uint64_t bits = row[i]; bits; bits &= bits - 1) {
+                    fn(m_x0 + (i << 6) + ctz64(bits), m_y0 + y);
+                }
+            }
+        }
+    }
+};
+
+// interned word pool. The words are sorted by length and then by letters,
+// and each word is identified by its index (word id).
+template <typename t_char>
+struct word_pool_t {
+    typedef std::basic_string<t_char> t_string;
+
+    span_t<t_char> m_chars;     // the letters of all the words
+    span_t<uint32_t> m_offsets; // m_offsets[id]: offset of word id in m_chars
+    span_t<uint32_t> m_firsts;  // m_firsts[len]: first id of the words of length len
+    span_t<t_char> m_alphabet;  // sorted letters in use
+
+    int size() const {
+        return int(m_offsets.size()) - 1;
+    }
+    int max_length() const {
+        return int(m_firsts.size()) - 2;
+    }
+    // the first word id of the words of length len
+    int first(int len) const {
+        if (len < 0)
+            return 0;
+        if (len > max_length())
+            return size();
+        return int(m_firsts[len]);
+    }
+    // the number of the words of length len
+    int count(int len) const {
+        return first(len + 1) - first(len);
+    }
+
+    int length(int id) const {
+        return int(m_offsets[id + 1] - m_offsets[id]);
+    }
+    const t_char *data(int id) const {
+        return m_chars.data() + m_offsets[id];
+    }
+    t_string str(int id) const {
+        return t_string(data(id), length(id));
+    }
+
+    // returns the word id, or -1 if not found
+    int find(const t_char *word, size_t len) const {
+        int lo = first(int(len)), hi = first(int(len) + 1);
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            int cmp = std::char_traits<t_char>::compare(data(mid), word, len);
+            if (cmp == 0)
+                return mid;
+            if (cmp < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return -1;
+    }
+    int find(const t_string& word) const {
+        return find(word.c_str(), word.size());
+    }
+
+    // returns the index of ch in m_alphabet, or -1 if not used
+    int letter_index(t_char ch) const {
+        auto it = std::lower_bound(m_alphabet.begin(), m_alphabet.end(), ch);
+        if (it == m_alphabet.end() || *it != ch)
+            return -1;
+        return int(it - m_alphabet.begin());
+    }
+};
+
+// positional letter index: (length, position, letter) --> bitset of the words of that length
+template <typename t_char>
+struct pat_index_t {
+    span_t<uint64_t> m_bits;
+    span_t<uint64_t> m_starts; // m_starts[len]: where the bitsets of length len start
+
+    // the bitset of the words of length len that have the iletter-th letter at pos
+    const uint64_t *get(const word_pool_t<t_char>& pool, int len, int pos, int iletter) const {
+        size_t units = (pool.count(len) + 63) / 64;
+        return m_bits.data() + m_starts[len] + (pos * pool.m_alphabet.size() + iletter) * units;
+    }
+};
+
+// inverted index: letter --> (word id, offset) pairs
+template <typename t_char>
+struct letter_index_t {
+    struct entry_t {
+        uint32_t m_word;
+        uint32_t m_offset;
+    };
+    span_t<entry_t> m_entries; // sorted by letter
+    span_t<uint32_t> m_starts; // m_starts[iletter]: the first entry of the letter
+};
+
+// letter trie of each word length, for wildcard descent
+template <typename t_char>
+struct trie_t {
+    struct node_t {
+        uint32_t m_first; // the first edge
+        uint32_t m_count; // the number of the edges
+    };
+    struct edge_t {
+        uint32_t m_letter; // letter index
+        uint32_t m_next;   // child node, or word id on the last letter
+    };
+    span_t<uint32_t> m_roots; // m_roots[len]: the root node of length len
+    span_t<node_t> m_nodes;
+    span_t<edge_t> m_edges;   // sorted by letter in each node
+
+    // calls fn(id) for each word in words below node that matches letters.
+    // letters[i] < 0 is a wildcard. fn returns false to stop.
+    // returns false if stopped.
+    template <typename t_fn>
+    bool descend(const int *letters, int len, int depth, uint32_t node,
+                 const bitset_t& words, t_fn& fn) const
+    {
+        auto& n = m_nodes[node];
+        const edge_t *first = m_edges.data() + n.m_first, *last = first + n.m_count;
+        if (letters[depth] >= 0) {
+            uint32_t letter = uint32_t(letters[depth]);
+            first = std::lower_bound(first, last, letter,
+                [](const edge_t& edge, uint32_t letter) {
+                    return edge.m_letter < letter;
+                }
+            );
+            if (first == last || first->m_letter != letter)
+                return true;
+            last = first + 1;
+        }
+        for (auto edge = first; edge != last; ++edge) {
+            if (depth + 1 == len) {
+                if (words.test(edge->m_next) && !fn(int(edge->m_next)))
+                    return false;
+            } else {
+                if (!descend(letters, len, depth + 1, edge->m_next, words, fn))
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+// the header of the dictionary image
+struct dict_header_t {
+    enum {
+        CHARS, OFFSETS, FIRSTS, ALPHABET,
+        PAT_BITS, PAT_STARTS, LETTER_ENTRIES, LETTER_STARTS,
+        TRIE_ROOTS, TRIE_NODES, TRIE_EDGES,
+        NUM_SECTIONS
+    };
+    struct section_t {
+        uint64_t m_offset; // in bytes from the top of the image
+        uint64_t m_count;  // the number of the elements
+    };
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_char_size;
+    uint64_t m_size; // the size of the image in bytes
+    section_t m_sections[NUM_SECTIONS];
+
+    static const char *magic() {
+        return "XWDICT\r\n";
+    }
+    enum { VERSION = 2 };
+};
+
+// builds the image of a dictionary from words
+template <typename t_char>
+struct dictionary_builder_t {
+    typedef std::basic_string<t_char> t_string;
+    typedef typename letter_index_t<t_char>::entry_t entry_t;
+    typedef typename trie_t<t_char>::node_t node_t;
+    typedef typename trie_t<t_char>::edge_t edge_t;
+
+    std::vector<t_char> m_chars;
+    std::vector<uint32_t> m_offsets;
+    std::vector<uint32_t> m_firsts;
+    std::vector<t_char> m_alphabet;
+    std::vector<uint64_t> m_pat_bits;
+    std::vector<uint64_t> m_pat_starts;
+    std::vector<entry_t> m_letter_entries;
+    std::vector<uint32_t> m_letter_starts;
+    std::vector<uint32_t> m_trie_roots;
+    std::vector<node_t> m_trie_nodes;
+    std::vector<edge_t> m_trie_edges;
+
+    dictionary_builder_t(const std::unordered_set<t_string>& words) {
+        build_pool(words);
+
+        word_pool_t<t_char> pool;
+        pool.m_chars = span_t<t_char>(m_chars.data(), m_chars.size());
+        pool.m_offsets = span_t<uint32_t>(m_offsets.data(), m_offsets.size());
+        pool.m_firsts = span_t<uint32_t>(m_firsts.data(), m_firsts.size());
+        pool.m_alphabet = span_t<t_char>(m_alphabet.data(), m_alphabet.size());
+        build_pat_index(pool);
+        build_letter_index(pool);
+        build_trie(pool);
+    }
+
+    void build_pool(const std::unordered_set<t_string>& words) {
+        std::vector<t_string> sorted;
+        sorted.reserve(words.size());
+        for (auto& word : words) {
+            if (word.size())
+                sorted.push_back(word);
+        }
+        std::sort(sorted.begin(), sorted.end(),
+            [](const t_string& word0, const t_string& word1) {
+                if (word0.size() != word1.size())
+                    return word0.size() < word1.size();
+                return word0 < word1;
+            }
+        );
+
+        size_t max_len = sorted.empty() ? 0 : sorted.back().size();
+        m_firsts.assign(max_len + 2, 0);
+        m_offsets.reserve(sorted.size() + 1);
+        for (auto& word : sorted) {
+            m_offsets.push_back(uint32_t(m_chars.size()));
+            m_chars.insert(m_chars.end(), word.begin(), word.end());
+            ++m_firsts[word.size() + 1];
+        }
+        m_offsets.push_back(uint32_t(m_chars.size()));
+        for (size_t len = 1; len < m_firsts.size(); ++len) {
+            m_firsts[len] += m_firsts[len - 1];
+        }
+
+        m_alphabet = m_chars;
+        std::sort(m_alphabet.begin(), m_alphabet.end());
+        m_alphabet.erase(std::unique(m_alphabet.begin(), m_alphabet.end()), m_alphabet.end());
+    }
+
+    void build_pat_index(const word_pool_t<t_char>& pool) {
+        size_t num_letters = m_alphabet.size();
+        m_pat_starts.assign(pool.max_length() + 2, 0);
+        for (int len = 0; len <= pool.max_length(); ++len) {
+            size_t units = (pool.count(len) + 63) / 64;
+            m_pat_starts[len + 1] = m_pat_starts[len] + len * num_letters * units;
+        }
+        m_pat_bits.assign(m_pat_starts.back(), 0);
+
+        for (int id = 0; id < pool.size(); ++id) {
+            int len = pool.length(id), iword = id - pool.first(len);
+            size_t units = (pool.count(len) + 63) / 64;
+            auto word = pool.data(id);
+            for (int ich = 0; ich < len; ++ich) {
+                size_t iletter = pool.letter_index(word[ich]);
+                uint64_t *bits = &m_pat_bits[m_pat_starts[len] + (ich * num_letters + iletter) * units];
+                bits[iword >> 6] |= (uint64_t(1) << (iword & 63));
+            }
+        }
+    }
+
+    void build_letter_index(const word_pool_t<t_char>& pool) {
+        m_letter_starts.assign(m_alphabet.size() + 1, 0);
+        for (auto ch : m_chars) {
+            ++m_letter_starts[pool.letter_index(ch) + 1];
+        }
+        for (size_t i = 1; i < m_letter_starts.size(); ++i) {
+            m_letter_starts[i] += m_letter_starts[i - 1];
+        }
+
+        std::vector<uint32_t> next(m_letter_starts.begin(), m_letter_starts.end() - 1);
+        m_letter_entries.resize(m_chars.size());
+        for (int id = 0; id < pool.size(); ++id) {
+            auto word = pool.data(id);
+            for (int ich = 0; ich < pool.length(id); ++ich) {
+                m_letter_entries[next[pool.letter_index(word[ich])]++] = { uint32_t(id), uint32_t(ich) };
+            }
+        }
+    }
+
+    void build_trie(const word_pool_t<t_char>& pool) {
+        std::vector<std::vector<edge_t> > children; // the edges of each node
+        for (int len = 0; len <= pool.max_length(); ++len) {
+            uint32_t root = uint32_t(children.size());
+            children.emplace_back();
+            m_trie_roots.push_back(root);
+            // the words are sorted, so a shared prefix is always on the last edges
+            for (int id = pool.first(len); id < pool.first(len + 1); ++id) {
+                auto word = pool.data(id);
+                uint32_t node = root;
+                for (int ich = 0; ich < len; ++ich) {
+                    uint32_t letter = uint32_t(pool.letter_index(word[ich]));
+                    if (ich + 1 == len) {
+                        children[node].push_back({ letter, uint32_t(id) });
+                        break;
+                    }
+                    if (children[node].empty() || children[node].back().m_letter != letter) {
+                        uint32_t child = uint32_t(children.size());
+                        children.emplace_back();
+                        children[node].push_back({ letter, child });
+                    }
+                    node = children[node].back().m_next;
+                }
+            }
+        }
+
+        m_trie_nodes.reserve(children.size());
+        for (auto& edges : children) {
+            m_trie_nodes.push_back({ uint32_t(m_trie_edges.size()), uint32_t(edges.size()) });
+            m_trie_edges.insert(m_trie_edges.end(), edges.begin(), edges.end());
+        }
+    }
+
+    std::vector<uint64_t> get_image() const {
+        dict_header_t header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.m_magic, dict_header_t::magic(), sizeof(header.m_magic));
+        header.m_version = dict_header_t::VERSION;
+        header.m_char_size = sizeof(t_char);
+
+        uint64_t size = (sizeof(header) + 7) & ~uint64_t(7);
+        auto add_section = [&](int i, size_t count, size_t elem_size) {
+            header.m_sections[i].m_offset = size;
+            header.m_sections[i].m_count = count;
+            size += (count * elem_size + 7) & ~uint64_t(7);
+        };
+        add_section(dict_header_t::CHARS, m_chars.size(), sizeof(t_char));
+        add_section(dict_header_t::OFFSETS, m_offsets.size(), sizeof(uint32_t));
+        add_section(dict_header_t::FIRSTS, m_firsts.size(), sizeof(uint32_t));
+        add_section(dict_header_t::ALPHABET, m_alphabet.size(), sizeof(t_char));
+        add_section(dict_header_t::PAT_BITS, m_pat_bits.size(), sizeof(uint64_t));
+        add_section(dict_header_t::PAT_STARTS, m_pat_starts.size(), sizeof(uint64_t));
+        add_section(dict_header_t::LETTER_ENTRIES, m_letter_entries.size(), sizeof(entry_t));
+        add_section(dict_header_t::LETTER_STARTS, m_letter_starts.size(), sizeof(uint32_t));
+        add_section(dict_header_t::TRIE_ROOTS, m_trie_roots.size(), sizeof(uint32_t));
+        add_section(dict_header_t::TRIE_NODES, m_trie_nodes.size(), sizeof(node_t));
+        add_section(dict_header_t::TRIE_EDGES, m_trie_edges.size(), sizeof(edge_t));
+        header.m_size = size;
+
+        std::vector<uint64_t> image(size / 8, 0);
+        auto base = reinterpret_cast<char *>(image.data());
+        std::memcpy(base, &header, sizeof(header));
+        auto copy_section = [&](int i, const void *data, size_t elem_size) {
+            auto& section = header.m_sections[i];
+            if (section.m_count)
+                std::memcpy(base + section.m_offset, data, section.m_count * elem_size);
+        };
+        copy_section(dict_header_t::CHARS, m_chars.data(), sizeof(t_char));
+        copy_section(dict_header_t::OFFSETS, m_offsets.data(), sizeof(uint32_t));
+        copy_section(dict_header_t::FIRSTS, m_firsts.data(), sizeof(uint32_t));
+        copy_section(dict_header_t::ALPHABET, m_alphabet.data(), sizeof(t_char));
+        copy_section(dict_header_t::PAT_BITS, m_pat_bits.data(), sizeof(uint64_t));
+        copy_section(dict_header_t::PAT_STARTS, m_pat_starts.data(), sizeof(uint64_t));
+        copy_section(dict_header_t::LETTER_ENTRIES, m_letter_entries.data(), sizeof(entry_t));
+        copy_section(dict_header_t::LETTER_STARTS, m_letter_starts.data(), sizeof(uint32_t));
+        copy_section(dict_header_t::TRIE_ROOTS, m_trie_roots.data(), sizeof(uint32_t));
+        copy_section(dict_header_t::TRIE_NODES, m_trie_nodes.data(), sizeof(node_t));
+        copy_section(dict_header_t::TRIE_EDGES, m_trie_edges.data(), sizeof(edge_t));
+        return image;
+    }
+};
+
+// the dictionary and its lookup indexes.
+// The data lives in one flat image, either built in memory or memory-mapped from a file.
+template <typename t_char>
+struct dictionary_t {
+    typedef std::basic_string<t_char> t_string;
+    typedef typename letter_index_t<t_char>::entry_t entry_t;
+
+    std::vector<uint64_t> m_image; // the image built in memory
+    mapped_file_t m_file;          // the image mapped from a file
+    const void *m_image_data;
+    size_t m_image_size;
+
+    word_pool_t<t_char> m_pool;
+    pat_index_t<t_char> m_pat_index;
+    letter_index_t<t_char> m_letter_index;
+    trie_t<t_char> m_trie;
+
+    dictionary_t(const std::unordered_set<t_string>& words)
+        : m_image(dictionary_builder_t<t_char>(words).get_image())
+    {
+        bool ok = attach(m_image.data(), m_image.size() * sizeof(uint64_t));
+        assert(ok);
+        (void)ok;
+    }
+    dictionary_t(const dictionary_t<t_char>&) = delete;
+    dictionary_t<t_char>& operator=(const dictionary_t<t_char>&) = delete;
+
+    // maps a file that save() wrote. returns nullptr on failure.
+    static std::shared_ptr<const dictionary_t<t_char> > load(const char *filename) {
+        std::shared_ptr<dictionary_t<t_char> > dict(new dictionary_t<t_char>());
+        if (!dict->m_file.open(filename) || !dict->attach(dict->m_file.m_data, dict->m_file.m_size))
+            return nullptr;
+        return dict;
+    }
+
+    bool save(const char *filename) const {
+        if (FILE *fp = std::fopen(filename, "wb")) {
+            bool ok = (std::fwrite(m_image_data, m_image_size, 1, fp) == 1);
+            return (std::fclose(fp) == 0) && ok;
+        }
+        return false;
+    }
+
+    int size() const {
+        return m_pool.size();
+    }
+    int length(int id) const {
+        return m_pool.length(id);
+    }
+    const t_char *data(int id) const {
+        return m_pool.data(id);
+    }
+    t_string str(int id) const {
+        return m_pool.str(id);
+    }
+    int find(const t_string& word) const {
+        return m_pool.find(word);
+    }
+
+    // the word ids of length len are [first(len), first(len) + count(len))
+    int first(int len) const {
+        return m_pool.first(len);
+    }
+    int count(int len) const {
+        return m_pool.count(len);
+    }
+    int num_letters() const {
+        return int(m_pool.m_alphabet.size());
+    }
+    int letter_index(t_char ch) const {
+        return m_pool.letter_index(ch);
+    }
+    // the words of length len that have the iletter-th letter at pos, indexed from first(len)
+    const uint64_t *pat_bits(int len, int pos, int iletter) const {
+        return m_pat_index.get(m_pool, len, pos, iletter);
+    }
+
+    // bits = the words in words that match pat, indexed from first(pat.size()).
+    // returns false if there are none.
+    bool match_bits(const t_string& pat, const bitset_t& words, bitset_t& bits) const {
+        int len = int(pat.size());
+        int first = m_pool.first(len), count = m_pool.count(len);
+        if (count == 0)
+            return false;
+
+        bits.assign_range(words, first, count);
+        for (int ich = 0; ich < len; ++ich) {
+            if (pat[ich] == '?')
+                continue;
+            int iletter = m_pool.letter_index(pat[ich]);
+            if (iletter < 0)
+                return false;
+            bits &= m_pat_index.get(m_pool, len, ich, iletter);
+        }
+        return bits.any();
+    }
+
+    // calls fn(id) for each word in words that matches pat. '?' is a wildcard.
+    template <typename t_fn>
+    void match(const t_string& pat, const bitset_t& words, t_fn fn) const {
+        bitset_t bits;
+        if (!match_bits(pat, words, bits))
+            return;
+        int first = m_pool.first(int(pat.size()));
+        bits.for_each([&](size_t iword) {
+            fn(first + int(iword));
+        });
+    }
+
+    // whether any word in words matches pat
+    bool any_match(const t_string& pat, const bitset_t& words) const {
+        bitset_t bits;
+        return match_bits(pat, words, bits);
+    }
+
+    // calls fn(id) for each word in words that matches pat, by the trie descent.
+    template <typename t_fn>
+    void match_trie(const t_string& pat, const bitset_t& words, t_fn fn) const {
+        std::vector<int> letters;
+        if (!get_letters(pat, letters))
+            return;
+        auto fn2 = [&](int id) {
+            fn(id);
+            return true;
+        };
+        m_trie.descend(letters.data(), int(letters.size()), 0, m_trie.m_roots[pat.size()], words, fn2);
+    }
 
-inline void reset() {
-    s_generated = s_canceled = false;
-#ifdef XWORDGIVER
-    for (auto& info : xg_aThreadInfo) {
-        info.m_count = 0;
+    // whether any word in words matches pat, by the trie descent
+    bool any_match_trie(const t_string& pat, const bitset_t& words) const {
+        std::vector<int> letters;
+        if (!get_letters(pat, letters))
+            return false;
+        auto fn = [](int) {
+            return false;
+        };
+        return !m_trie.descend(letters.data(), int(letters.size()), 0, m_trie.m_roots[pat.size()], words, fn);
     }
-#endif
-}
 
-inline void wait_for_threads(int num_threads = get_num_processors(), int retry_count = 3) {
-    const int INTERVAL = 100;
-    for (int i = 0; i < retry_count; ++i) {
-        if (s_generated || s_canceled)
-            break;
-        std::this_thread::sleep_for(std::chrono::milliseconds(INTERVAL));
+    // the (word id, offset) pairs of the letter ch
+    std::pair<const entry_t *, const entry_t *> find_letter(t_char ch) const {
+        int iletter = m_pool.letter_index(ch);
+        if (iletter < 0)
+            return std::make_pair(nullptr, nullptr);
+        auto entries = m_letter_index.m_entries.data();
+        return std::make_pair(entries + m_letter_index.m_starts[iletter],
+                              entries + m_letter_index.m_starts[iletter + 1]);
     }
-}
 
-template <typename t_char>
-inline bool
-check_connectivity(const std::unordered_set<std::basic_string<t_char> >& words,
-                   std::basic_string<t_char>& nonconnected)
-{
-    typedef std::basic_string<t_char> t_string;
-    if (words.size() <= 1)
-        return true;
+    static void unittest() {
+#ifndef NDEBUG
+        std::unordered_set<t_string> words;
+        for (auto word : { "CAT", "COT", "CUT", "DOG", "ACT", "GO", "TACO" }) {
+            words.insert(t_string(word, word + std::char_traits<char>::length(word)));
+        }
+        dictionary_t<t_char> dict(words);
+        assert(dict.size() == 7);
+        assert(dict.length(0) == 2);
+        assert(dict.length(dict.size() - 1) == 4);
+        for (auto& word : words) {
+            assert(dict.find(word) >= 0);
+            assert(dict.str(dict.find(word)) == word);
+        }
+        t_string pat;
+        pat += 'C'; pat += '?'; pat += 'T';
+        bitset_t all(dict.size(), true);
+        std::unordered_set<int> ids;
+        dict.match(pat, all, [&](int id) { ids.insert(id); });
+        assert(ids.size() == 3);
+        bitset_t bits;
+        assert(dict.match_bits(pat, all, bits) && bits.count() == 3);
+        assert(dict.first(3) == dict.first(2) + dict.count(2));
+        bitset_t rest = all;
+        rest.reset(*ids.begin());
+        ids.clear();
+        dict.match(pat, rest, [&](int id) { ids.insert(id); });
+        assert(ids.size() == 2);
+        std::unordered_set<int> ids2;
+        dict.match_trie(pat, rest, [&](int id) { ids2.insert(id); });
+        assert(ids == ids2);
+        assert(dict.any_match(pat, rest) && dict.any_match_trie(pat, rest));
+        pat[0] = 'D';
+        assert(!dict.any_match(pat, all) && !dict.any_match_trie(pat, all));
+        pat[0] = pat[1] = '?';
+        ids.clear();
+        dict.match_trie(pat, all, [&](int id) { ids.insert(id); });
+        assert(ids.size() == 4);
+        auto entries = dict.find_letter('O');
+        assert(entries.second - entries.first == 4);
+        for (auto entry = entries.first; entry != entries.second; ++entry) {
+            assert(dict.data(entry->m_word)[entry->m_offset] == 'O');
+        }
+        dictionary_t<t_char> copy;
+        assert(copy.attach(dict.m_image_data, dict.m_image_size));
+        assert(copy.size() == dict.size());
+        assert(copy.find(*words.begin()) == dict.find(*words.begin()));
+        assert(!copy.attach(dict.m_image_data, sizeof(dict_header_t) - 1));
+#endif
+    }
 
-    std::vector<t_string> vec_words(words.begin(), words.end());
-    std::queue<size_t> queue;
-    std::unordered_set<size_t> indexes;
-    queue.emplace(0);
-
-    while (!queue.empty()) {
-        size_t index0 = queue.front();
-        indexes.insert(index0);
-        queue.pop();
-
-        auto& w0 = vec_words[index0];
-        for (size_t index1 = 0; index1 < vec_words.size(); ++index1) {
-            if (index0 == index1)
-                continue;
+protected:
+    dictionary_t() : m_image_data(nullptr), m_image_size(0) { }
 
-            auto& w1 = vec_words[index1];
-            for (auto ch0 : w0) {
-                for (auto ch1 : w1) {
-                    if (ch0 == ch1) {
-                        if (indexes.count(index1) == 0) {
-                            queue.emplace(index1);
-                            goto skip;
-                        }
-                    }
-                }
+    // converts pat to letter indexes. '?' becomes -1.
+    bool get_letters(const t_string& pat, std::vector<int>& letters) const {
+        if (pat.empty() || int(pat.size()) > m_pool.max_length())
+            return false;
+        letters.resize(pat.size());
+        for (size_t ich = 0; ich < pat.size(); ++ich) {
+            if (pat[ich] == '?') {
+                letters[ich] = -1;
+            } else {
+                letters[ich] = m_pool.letter_index(pat[ich]);
+                if (letters[ich] < 0)
+                    return false;
             }
-skip:;
         }
+        return true;
     }
 
-    for (size_t i = 0; i < vec_words.size(); ++i) {
-        if (indexes.count(i) == 0) {
-            nonconnected = vec_words[i];
+    template <typename T>
+    bool get_section(const dict_header_t& header, int i, span_t<T>& span) const {
+        auto& section = header.m_sections[i];
+        if ((section.m_offset & 7) || section.m_offset > m_image_size ||
+            section.m_count > (m_image_size - section.m_offset) / sizeof(T))
+        {
             return false;
         }
+        auto base = static_cast<const char *>(m_image_data);
+        span = span_t<T>(reinterpret_cast<const T *>(base + section.m_offset), size_t(section.m_count));
+        return true;
     }
 
-    return true;
+    // points the indexes into the image. No parsing is done.
+    bool attach(const void *data, size_t size) {
+        m_image_data = data;
+        m_image_size = size;
+        if (size < sizeof(dict_header_t))
+            return false;
+        auto& header = *static_cast<const dict_header_t *>(data);
+        if (std::memcmp(header.m_magic, dict_header_t::magic(), sizeof(header.m_magic)) != 0 ||
+            header.m_version != dict_header_t::VERSION ||
+            header.m_char_size != sizeof(t_char) || header.m_size != size)
+        {
+            return false;
+        }
+        if (!get_section(header, dict_header_t::CHARS, m_pool.m_chars) ||
+            !get_section(header, dict_header_t::OFFSETS, m_pool.m_offsets) ||
+            !get_section(header, dict_header_t::FIRSTS, m_pool.m_firsts) ||
+            !get_section(header, dict_header_t::ALPHABET, m_pool.m_alphabet) ||
+            !get_section(header, dict_header_t::PAT_BITS, m_pat_index.m_bits) ||
+            !get_section(header, dict_header_t::PAT_STARTS, m_pat_index.m_starts) ||
+            !get_section(header, dict_header_t::LETTER_ENTRIES, m_letter_index.m_entries) ||
+            !get_section(header, dict_header_t::LETTER_STARTS, m_letter_index.m_starts) ||
+            !get_section(header, dict_header_t::TRIE_ROOTS, m_trie.m_roots) ||
+            !get_section(header, dict_header_t::TRIE_NODES, m_trie.m_nodes) ||
+            !get_section(header, dict_header_t::TRIE_EDGES, m_trie.m_edges))
+        {
+            return false;
+        }
+        // cheap consistency checks
+        return m_pool.m_offsets.size() >= 1 && m_pool.m_firsts.size() >= 2 &&
+               m_pool.m_firsts.back() == m_pool.m_offsets.size() - 1 &&
+               m_pool.m_offsets.back() == m_pool.m_chars.size() &&
+               m_pat_index.m_starts.size() == m_pool.m_firsts.size() &&
+               m_pat_index.m_starts.back() == m_pat_index.m_bits.size() &&
+               m_letter_index.m_starts.size() == m_pool.m_alphabet.size() + 1 &&
+               m_letter_index.m_starts.back() == m_letter_index.m_entries.size() &&
+               m_trie.m_roots.size() == m_pool.m_firsts.size() - 1;
+    }
+};
+
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+    return x ^ (x >> 31);
 }
 
+// Zobrist keys of the search states. a state hashes to the XOR of the keys of its parts.
+struct zobrist_t {
+    static uint64_t pos(int x, int y) {
+        return splitmix64(uint64_t(uint32_t(x)) | (uint64_t(uint32_t(y)) << 32));
+    }
+    // a letter or a black cell at (x, y). empty cells don't count.
+    template <typename t_char>
+    static uint64_t cell(int x, int y, t_char ch) {
+        if (ch == '?')
+            return 0;
+        return splitmix64(pos(x, y) ^ uint64_t(ch));
+    }
+    // a used word
+    static uint64_t word(int id) {
+        return splitmix64(uint64_t(uint32_t(id)) ^ 0xD6E8FEB86659FD93);
+    }
+    // a crossable position
+    static uint64_t flag(int which, int x, int y) {
+        return splitmix64(pos(x, y) ^ (0xA0761D6478BD642F + uint64_t(which)));
+    }
+    // the rules of a LOOKAHEAD mode. LOOKAHEAD::NONE lets a crossing repeat a word,
+    // so its failed states must not be mixed with those of the other modes.
+    static uint64_t lookahead(int mode) {
+        return (mode == LOOKAHEAD::NONE) ? 0x8BB84B93962EACC9 : 0;
+    }
+};
+
+// the hashes of the states proven to fail, shared by the threads.
+// a full bucket evicts an entry chosen by the new hash.
+struct nogood_table_t {
+    enum { BUCKET = 4 }; // the entries per bucket
+    std::unique_ptr<std::atomic<uint64_t>[]> m_entries; // 0 means empty
+    size_t m_mask; // the number of the buckets - 1
+    std::atomic<uint64_t> m_calls{0};
+
+    // max_bytes: the memory cap
+    nogood_table_t(size_t max_bytes) {
+        size_t buckets = 1;
+        while (buckets * 2 * BUCKET * sizeof(uint64_t) <= max_bytes)
+            buckets *= 2;
+        m_entries.reset(new std::atomic<uint64_t>[buckets * BUCKET]);
+        for (size_t i = 0; i < buckets * BUCKET; ++i)
+            m_entries[i].store(0, std::memory_order_relaxed);
+        m_mask = buckets - 1;
+    }
+
+    // the initial hash of a new call. the states of the earlier calls never match it.
+    uint64_t new_salt() {
+        return splitmix64(m_calls.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+
+    bool contains(uint64_t hash) const {
+        uint64_t key = (hash ? hash : 1);
+        auto entries = &m_entries[(key & m_mask) * BUCKET];
+        for (int i = 0; i < BUCKET; ++i) {
+            if (entries[i].load(std::memory_order_relaxed) == key)
+                return true;
+        }
+        return false;
+    }
+
+    void insert(uint64_t hash) {
+        uint64_t key = (hash ? hash : 1);
+        auto entries = &m_entries[(key & m_mask) * BUCKET];
+        for (int i = 0; i < BUCKET; ++i) {
+            uint64_t old = entries[i].load(std::memory_order_relaxed);
+            if (old == key)
+                return;
+            if (old == 0 && entries[i].compare_exchange_strong(old, key, std::memory_order_relaxed))
+                return;
+        }
+        entries[(key >> 32) % BUCKET].store(key, std::memory_order_relaxed);
+    }
+
+    static void unittest() {
+#ifndef NDEBUG
+        nogood_table_t table(1024);
+        assert(table.m_mask + 1 == 1024 / (BUCKET * sizeof(uint64_t)));
+        assert(!table.contains(zobrist_t::word(1)));
+        table.insert(zobrist_t::word(1));
+        assert(table.contains(zobrist_t::word(1)));
+        assert(!table.contains(zobrist_t::word(2)));
+        uint64_t salt = table.new_salt();
+        assert(salt != table.new_salt());
+        assert(!table.contains(salt ^ zobrist_t::word(1)));
+        for (int i = 0; i < 1000; ++i)
+            table.insert(zobrist_t::word(i));
+        assert(table.contains(zobrist_t::word(999)));
+        assert(zobrist_t::cell(0, 0, '?') == 0);
+        assert(zobrist_t::cell(1, 2, 'A') != zobrist_t::cell(2, 1, 'A'));
+#endif
+    }
+};
+
+// undo log for in-place backtracking
+template <typename t_char>
+struct trail_t {
+    struct cell_t {
+        int m_x, m_y;
+        t_char m_ch; // the old letter
+    };
+    struct flag_t {
+        int m_x, m_y;
+        int m_which; // which set of positions
+        bool m_value; // the old value
+    };
+    struct bits_t {
+        int m_index; // the slot or the cell
+        bitset_t m_bits; // the old bits
+    };
+    struct mark_t {
+        size_t m_cells, m_words, m_flags, m_slots, m_domains, m_masks, m_conflicts;
+        uint64_t m_hash;
+    };
+
+    std::vector<cell_t> m_cells;
+    std::vector<int> m_words; // the removed word ids
+    std::vector<flag_t> m_flags;
+    std::vector<int> m_slots; // the slots marked
+    std::vector<bits_t> m_domains;
+    std::vector<bits_t> m_masks;
+    std::vector<bits_t> m_conflicts;
+    uint64_t m_hash = 0; // the Zobrist hash of the state
+
+    mark_t mark() const {
+        return { m_cells.size(), m_words.size(), m_flags.size(), m_slots.size(),
+                 m_domains.size(), m_masks.size(), m_conflicts.size(), m_hash };
+    }
+};
+
 template <typename t_char>
 struct candidate_t {
-    typedef std::basic_string<t_char> t_string;
     int m_x, m_y;
-    t_string m_word;
+    int m_word; // word id, or -1 for a single letter on the board
     bool m_vertical;
 };
 
@@ -240,21 +1572,29 @@ struct board_t : board_data_t<t_char> {
     int m_cx, m_cy;
     int m_rules;
     int m_x0, m_y0;
+    // canvas mode: m_data is larger than the board and has free cells around it.
+    // the flat methods of board_data_t see the whole canvas. compact() first.
+    bool m_canvas;
+    int m_stride; // the row length of m_data
+    int m_offset; // the index of (0, 0) in m_data
 
     board_t(int cx = 1, int cy = 1, t_char ch = ' ', int rules = 0, int x0 = 0, int y0 = 0)
         : board_data_t<t_char>(cx, cy, ch), m_cx(cx), m_cy(cy)
         , m_rules(rules), m_x0(x0), m_y0(y0)
+        , m_canvas(false), m_stride(cx), m_offset(0)
     {
     }
     board_t(const board_t<t_char, t_fixed>& b) = default;
     board_t<t_char, t_fixed>& operator=(const board_t<t_char, t_fixed>& b) = default;
 
     t_char get(int xy) const {
+        assert(!m_canvas);
         if (0 <= xy && xy < this->size())
             return board_data_t<t_char>::m_data[xy];
         return t_fixed ? '#' : '?';
     }
     void set(int xy, t_char ch) {
+        assert(!m_canvas);
         if (0 <= xy && xy < this->size())
             board_data_t<t_char>::m_data[xy] = ch;
     }
@@ -267,19 +1607,19 @@ struct board_t : board_data_t<t_char> {
     // x, y: absolute coordinate
     t_char real_get_at(int x, int y) const {
         if (in_range(x, y))
-            return board_data_t<t_char>::m_data[y * m_cx + x];
+            return board_data_t<t_char>::m_data[m_offset + y * m_stride + x];
         return ' ';
     }
     // x, y: absolute coordinate
     t_char get_at(int x, int y) const {
         if (in_range(x, y))
-            return board_data_t<t_char>::m_data[y * m_cx + x];
+            return board_data_t<t_char>::m_data[m_offset + y * m_stride + x];
         return t_fixed ? '#' : '?';
     }
     // x, y: absolute coordinate
     void set_at(int x, int y, t_char ch) {
         if (in_range(x, y))
-            board_data_t<t_char>::m_data[y * m_cx + x] = ch;
+            board_data_t<t_char>::m_data[m_offset + y * m_stride + x] = ch;
     }
     // x, y: absolute coordinate
     void mirror_set_black_at(int x, int y) {
@@ -389,21 +1729,7 @@ struct board_t : board_data_t<t_char> {
     bool can_make_tri_direction(int x, int y) {
         auto ch = get_at(x, y);
         set_at(x, y, '#');
-        bool ret = false;
-        for (int i = y - 4; i <= y + 4; ++y) {
-            for (int j = x - 4; i <= x + 4; ++i) {
-                int sum = 0;
-                sum += (real_get_at(j, i - 1) == '#');
-                sum += (real_get_at(j, i + 1) == '#');
-                sum += (real_get_at(j - 1, i) == '#');
-                sum += (real_get_at(j + 1, i) == '#');
-                if (sum >= 3) {
-                    ret = true;
-                    goto skip;
-                }
-            }
-        }
-skip:;
+        bool ret = tri_black_near(x, y);
         set_at(x, y, ch);
         return ret;
     }
@@ -439,36 +1765,7 @@ skip:;
     bool can_make_four_diagonals(int x, int y) {
         auto ch = get_at(x, y);
         set_at(x, y, '#');
-        bool ret = false;
-        for (int i = y - 3; i <= y + 3; ++y) {
-            for (int j = x - 3; i <= x + 3; ++i) {
-                if (real_get_at(j, i) != '#')
-                    continue;
-                if (real_get_at(j + 1, i + 1) != '#')
-                    continue;
-                if (real_get_at(j + 2, i + 2) != '#')
-                    continue;
-                if (real_get_at(j + 3, i + 3) != '#')
-                    continue;
-                ret = true;
-                goto skip;
-            }
-        }
-        for (int i = y - 3; i <= y + 3; ++y) {
-            for (int j = x - 3; i <= x + 3; ++i) {
-                if (real_get_at(j, i) != '#')
-                    continue;
-                if (real_get_at(j - 1, i + 1) != '#')
-                    continue;
-                if (real_get_at(j - 2, i + 2) != '#')
-                    continue;
-                if (real_get_at(j - 3, i + 3) != '#')
-                    continue;
-                ret = true;
-                goto skip;
-            }
-        }
-skip:;
+        bool ret = (diagonal_run(x, y, 1) >= 4 || diagonal_run(x, y, -1) >= 4);
         set_at(x, y, ch);
         return ret;
     }
@@ -673,6 +1970,7 @@ skip:;
 
         this->m_data = std::move(data.m_data);
         m_cx += cx;
+        set_dense();
     }
 
     // y0: absolute coordinate
@@ -693,12 +1991,20 @@ skip:;
 
         this->m_data = std::move(data.m_data);
         m_cy += cy;
+        set_dense();
     }
 
     // x0: absolute coordinate
     void delete_x(int x0) {
         assert(0 <= x0 && x0 < m_cx);
 
+        if (m_canvas && (x0 == 0 || x0 == m_cx - 1)) {
+            if (x0 == 0)
+                ++m_offset;
+            --m_cx;
+            return;
+        }
+
         board_t<t_char, t_fixed> data(m_cx - 1, m_cy, ' ');
 
         for (int y = 0; y < m_cy; ++y) {
@@ -712,12 +2018,20 @@ skip:;
 
         this->m_data = std::move(data.m_data);
         --m_cx;
+        set_dense();
     }
 
     // y0: absolute coordinate
     void delete_y(int y0) {
         assert(0 <= y0 && y0 < m_cy);
 
+        if (m_canvas && (y0 == 0 || y0 == m_cy - 1)) {
+            if (y0 == 0)
+                m_offset += m_stride;
+            --m_cy;
+            return;
+        }
+
         board_t<t_char, t_fixed> data(m_cx, m_cy - 1, ' ');
 
         for (int y = 0; y < m_cy - 1; ++y) {
@@ -731,26 +2045,120 @@ skip:;
 
         this->m_data = std::move(data.m_data);
         --m_cy;
+        set_dense();
+    }
+
+    void set_dense() {
+        m_canvas = false;
+        m_stride = m_cx;
+        m_offset = 0;
+    }
+
+    // the free cells of the canvas around the board
+    int free_left() const {
+        return m_offset % m_stride;
+    }
+    int free_right() const {
+        return m_stride - free_left() - m_cx;
+    }
+    int free_top() const {
+        return m_offset / m_stride;
+    }
+    int free_bottom() const {
+        return this->size() / m_stride - free_top() - m_cy;
+    }
+
+    // makes a canvas with margin_x columns and margin_y rows free on each side
+    void reserve(int margin_x, int margin_y) {
+        int stride = m_cx + 2 * margin_x;
+        t_string data(size_t(stride) * (m_cy + 2 * margin_y), ' ');
+        int offset = margin_y * stride + margin_x;
+        for (int y = 0; y < m_cy; ++y) {
+            for (int x = 0; x < m_cx; ++x) {
+                data[offset + y * stride + x] = get_at(x, y);
+            }
+        }
+        this->m_data = std::move(data);
+        m_canvas = true;
+        m_stride = stride;
+        m_offset = offset;
+    }
+
+    // drops the free cells of the canvas
+    void compact() {
+        if (!m_canvas)
+            return;
+        t_string data(size_t(m_cx) * m_cy, ' ');
+        for (int y = 0; y < m_cy; ++y) {
+            for (int x = 0; x < m_cx; ++x) {
+                data[y * m_cx + x] = get_at(x, y);
+            }
+        }
+        this->m_data = std::move(data);
+        set_dense();
     }
 
+    // fills the cells [x0, x0 + cx) x [y0, y0 + cy) of the canvas with ch.
+    // x0, y0: absolute coordinate
+    void fill_canvas(int x0, int y0, int cx, int cy, t_char ch) {
+        for (int y = y0; y < y0 + cy; ++y) {
+            auto row = &this->m_data[m_offset + y * m_stride];
+            std::fill(row + x0, row + x0 + cx, ch);
+        }
+    }
+
+    // on a canvas, growing moves the bounds into the free cells.
+    // if they run out, the canvas is made again with double the margins.
     void grow_x0(int cx, t_char ch = ' ') {
         assert(cx > 0);
-        insert_x(0, cx, ch);
+        if (!m_canvas) {
+            insert_x(0, cx, ch);
+            m_x0 -= cx;
+            return;
+        }
+        if (free_left() < cx)
+            reserve(std::max(cx, m_cx), std::max(free_top(), free_bottom()));
+        m_offset -= cx;
+        m_cx += cx;
         m_x0 -= cx;
+        fill_canvas(0, 0, cx, m_cy, ch);
     }
     void grow_x1(int cx, t_char ch = ' ') {
         assert(cx > 0);
-        insert_x(m_cx, cx, ch);
+        if (!m_canvas) {
+            insert_x(m_cx, cx, ch);
+            return;
+        }
+        if (free_right() < cx)
+            reserve(std::max(cx, m_cx), std::max(free_top(), free_bottom()));
+        m_cx += cx;
+        fill_canvas(m_cx - cx, 0, cx, m_cy, ch);
     }
 
     void grow_y0(int cy, t_char ch = ' ') {
         assert(cy > 0);
-        insert_y(0, cy, ch);
+        if (!m_canvas) {
+            insert_y(0, cy, ch);
+            m_y0 -= cy;
+            return;
+        }
+        if (free_top() < cy)
+            reserve(std::max(free_left(), free_right()), std::max(cy, m_cy));
+        m_offset -= cy * m_stride;
+        m_cy += cy;
         m_y0 -= cy;
+        fill_canvas(0, 0, m_cx, cy, ch);
     }
     void grow_y1(int cy, t_char ch = ' ') {
         assert(cy > 0);
-        insert_y(m_cy, cy, ch);
+        if (!m_canvas) {
+            insert_y(m_cy, cy, ch);
+            return;
+        }
+        if (free_bottom() < cy)
+            reserve(std::max(free_left(), free_right()), std::max(cy, m_cy));
+        m_cy += cy;
+        fill_canvas(0, m_cy - cy, m_cx, cy, ch);
     }
 
     void trim_x() {
@@ -829,96 +2237,365 @@ skip:;
             if (!found) {
                 delete_y(m_cy - 1);
             } else {
-                break;
+                break;
+            }
+        }
+
+        m_y0 = 0;
+    }
+
+    void trim() {
+        trim_y();
+        trim_x();
+    }
+
+    void print() const {
+        std::printf("dx:%d, dy:%d, cx:%d, cy:%d\n", m_x0, m_y0, m_cx, m_cy);
+        for (int y = m_y0; y < m_y0 + m_cy; ++y) {
+            std::printf("%3d: ", y);
+            for (int x = m_x0; x < m_x0 + m_cx; ++x) {
+                auto ch = get_on(x, y);
+                std::putchar(ch);
+            }
+            std::printf("\n");
+        }
+        std::fflush(stdout);
+    }
+
+    bool is_crossable_x(int x, int y) const {
+        assert(is_letter(get_on(x, y)));
+        t_char ch1, ch2;
+        ch1 = get_on(x - 1, y);
+        ch2 = get_on(x + 1, y);
+        return (ch1 == '?' || ch2 == '?');
+    }
+    bool is_crossable_y(int x, int y) const {
+        assert(is_letter(get_on(x, y)));
+        t_char ch1, ch2;
+        ch1 = get_on(x, y - 1);
+        ch2 = get_on(x, y + 1);
+        return (ch1 == '?' || ch2 == '?');
+    }
+
+    bool must_be_cross(int x, int y) const {
+        assert(is_letter(get_on(x, y)));
+        t_char ch1, ch2;
+        ch1 = get_on(x - 1, y);
+        ch2 = get_on(x + 1, y);
+        bool flag1 = (is_letter(ch1) || is_letter(ch2));
+        ch1 = get_on(x, y - 1);
+        ch2 = get_on(x, y + 1);
+        bool flag2 = (is_letter(ch1) || is_letter(ch2));
+        return flag1 && flag2;
+    }
+
+    void apply_size(const candidate_t<t_char>& cand, int len) {
+        int x = cand.m_x, y = cand.m_y;
+        if (cand.m_vertical) {
+            ensure(x, y - 1);
+            ensure(x, y + len);
+        }
+        else {
+            ensure(x - 1, y);
+            ensure(x + len, y);
+        }
+    }
+    // the size that apply_size(cand, len) would make, without copying the board
+    void get_applied_size(const candidate_t<t_char>& cand, int len, int& cx, int& cy) const {
+        int x0 = cand.m_x, y0 = cand.m_y, x1 = cand.m_x, y1 = cand.m_y;
+        if (cand.m_vertical) {
+            --y0;
+            y1 += len;
+        } else {
+            --x0;
+            x1 += len;
+        }
+        cx = std::max(m_x0 + m_cx, x1 + 1) - std::min(m_x0, x0);
+        cy = std::max(m_y0 + m_cy, y1 + 1) - std::min(m_y0, y0);
+    }
+
+    bool rules_ok() const {
+        return rules_ok(m_rules);
+    }
+    // rules: the RULES to check
+    bool rules_ok(int rules) const {
+        if (rules == 0)
+            return true;
+
+        // the rows as bitmasks up to 64 by 64. others is only for the symmetries.
+        const int symmetries = RULES::POINTSYMMETRY | RULES::LINESYMMETRYH | RULES::LINESYMMETRYV;
+        rows_t blacks, others;
+        if (get_rows(blacks.data(), (rules & symmetries) ? others.data() : nullptr)) {
+            if ((rules & RULES::DONTDOUBLEBLACK) && double_black(blacks.data()))
+                return false;
+            if ((rules & RULES::DONTCORNERBLACK) && corner_black())
+                return false;
+            if ((rules & RULES::DONTTRIDIRECTIONS) && tri_black_around(blacks.data()))
+                return false;
+            if ((rules & RULES::DONTTHREEDIAGONALS) && three_diagonals(blacks.data()))
+                return false;
+            else if ((rules & RULES::DONTFOURDIAGONALS) && four_diagonals(blacks.data()))
+                return false;
+            // every symmetry that is set, like the loops below
+            if ((rules & RULES::POINTSYMMETRY) &&
+                !is_point_symmetry(blacks.data(), others.data()))
+            {
+                return false;
+            }
+            if ((rules & RULES::LINESYMMETRYH) &&
+                !is_line_symmetry_h(blacks.data(), others.data()))
+            {
+                return false;
+            }
+            if ((rules & RULES::LINESYMMETRYV) &&
+                !is_line_symmetry_v(blacks.data(), others.data()))
+            {
+                return false;
+            }
+            if ((rules & RULES::DONTDIVIDE) && divided_by_black(blacks.data()))
+                return false;
+            return true;
+        }
+
+        if ((rules & RULES::DONTDOUBLEBLACK) && double_black())
+            return false;
+        if ((rules & RULES::DONTCORNERBLACK) && corner_black())
+            return false;
+        if ((rules & RULES::DONTTRIDIRECTIONS) && tri_black_around())
+            return false;
+        if ((rules & RULES::DONTTHREEDIAGONALS) && three_diagonals())
+            return false;
+        else if ((rules & RULES::DONTFOURDIAGONALS) && four_diagonals())
+            return false;
+        if ((rules & RULES::POINTSYMMETRY) && !is_point_symmetry()) {
+            return false;
+        } else {
+            if ((rules & RULES::LINESYMMETRYH) && !is_line_symmetry_h())
+                return false;
+            if ((rules & RULES::LINESYMMETRYV) && !is_line_symmetry_v())
+                return false;
+        }
+        if ((rules & RULES::DONTDIVIDE) && divided_by_black())
+            return false;
+        return true;
+    }
+
+    typedef std::array<uint64_t, 64> rows_t;
+
+    // bit x of blacks[y] is set if (x, y) is black. bit x of others[y] is set
+    // if (x, y) is neither black nor '?'. others may be null.
+    // returns false if wider or taller than 64.
+    bool get_rows(uint64_t *blacks, uint64_t *others) const {
+        if (m_cx > 64 || m_cy > 64)
+            return false;
+        auto data = this->m_data.data();
+        for (int y = 0; y < m_cy; ++y) {
+            auto row = data + m_offset + y * m_stride;
+            uint64_t black = 0, other = 0;
+            if (others) {
+                for (int x = 0; x < m_cx; ++x) {
+                    black |= uint64_t(row[x] == '#') << x;
+                    other |= uint64_t(row[x] != '#' && row[x] != '?') << x;
+                }
+                others[y] = other;
+            } else {
+                for (int x = 0; x < m_cx; ++x)
+                    black |= uint64_t(row[x] == '#') << x;
             }
+            blacks[y] = black;
         }
+        return true;
+    }
 
-        m_y0 = 0;
+    // the bits of the columns 0 to m_cx - 1
+    uint64_t row_mask() const {
+        return (m_cx >= 64) ? ~uint64_t(0) : ((uint64_t(1) << m_cx) - 1);
+    }
+    // flips a row horizontally
+    uint64_t mirror_row(uint64_t row) const {
+        return reverse_bits64(row) >> (64 - m_cx);
     }
 
-    void trim() {
-        trim_y();
-        trim_x();
+    bool double_black(const uint64_t *blacks) const {
+        for (int y = 0; y < m_cy; ++y) {
+            if (blacks[y] & (blacks[y] >> 1))
+                return true;
+            if (y + 1 < m_cy && (blacks[y] & blacks[y + 1]))
+                return true;
+        }
+        return false;
     }
 
-    void print() const {
-        std::printf("dx:%d, dy:%d, cx:%d, cy:%d\n", m_x0, m_y0, m_cx, m_cy);
-        for (int y = m_y0; y < m_y0 + m_cy; ++y) {
-            std::printf("%3d: ", y);
-            for (int x = m_x0; x < m_x0 + m_cx; ++x) {
-                auto ch = get_on(x, y);
-                std::putchar(ch);
-            }
-            std::printf("\n");
+    bool tri_black_around(const uint64_t *blacks) const {
+        const uint64_t inner = (row_mask() >> 1) & ~uint64_t(1);
+        for (int y = 1; y < m_cy - 1; ++y) {
+            uint64_t up = blacks[y - 1], down = blacks[y + 1];
+            uint64_t left = blacks[y] << 1, right = blacks[y] >> 1;
+            // three or more of the four
+            uint64_t tri = (up & down & (left | right)) | (left & right & (up | down));
+            if (tri & inner)
+                return true;
         }
-        std::fflush(stdout);
+        return false;
     }
 
-    bool is_crossable_x(int x, int y) const {
-        assert(is_letter(get_on(x, y)));
-        t_char ch1, ch2;
-        ch1 = get_on(x - 1, y);
-        ch2 = get_on(x + 1, y);
-        return (ch1 == '?' || ch2 == '?');
+    bool four_diagonals(const uint64_t *blacks) const {
+        for (int y = 0; y < m_cy - 3; ++y) {
+            if (blacks[y] & (blacks[y + 1] >> 1) & (blacks[y + 2] >> 2) & (blacks[y + 3] >> 3))
+                return true;
+            if (blacks[y] & (blacks[y + 1] << 1) & (blacks[y + 2] << 2) & (blacks[y + 3] << 3))
+                return true;
+        }
+        return false;
     }
-    bool is_crossable_y(int x, int y) const {
-        assert(is_letter(get_on(x, y)));
-        t_char ch1, ch2;
-        ch1 = get_on(x, y - 1);
-        ch2 = get_on(x, y + 1);
-        return (ch1 == '?' || ch2 == '?');
+
+    bool three_diagonals(const uint64_t *blacks) const {
+        for (int y = 0; y < m_cy - 2; ++y) {
+            if (blacks[y] & (blacks[y + 1] >> 1) & (blacks[y + 2] >> 2))
+                return true;
+            if (blacks[y] & (blacks[y + 1] << 1) & (blacks[y + 2] << 2))
+                return true;
+        }
+        return false;
     }
 
-    bool must_be_cross(int x, int y) const {
-        assert(is_letter(get_on(x, y)));
-        t_char ch1, ch2;
-        ch1 = get_on(x - 1, y);
-        ch2 = get_on(x + 1, y);
-        bool flag1 = (is_letter(ch1) || is_letter(ch2));
-        ch1 = get_on(x, y - 1);
-        ch2 = get_on(x, y + 1);
-        bool flag2 = (is_letter(ch1) || is_letter(ch2));
-        return flag1 && flag2;
+    bool is_point_symmetry(const uint64_t *blacks, const uint64_t *others) const {
+        for (int y = 0; y < m_cy; ++y) {
+            if (blacks[y] & mirror_row(others[m_cy - (y + 1)]))
+                return false;
+        }
+        return true;
     }
 
-    void apply_size(const candidate_t<t_char>& cand) {
-        auto& word = cand.m_word;
-        int x = cand.m_x, y = cand.m_y;
-        if (cand.m_vertical) {
-            ensure(x, y - 1);
-            ensure(x, y + int(word.size()));
+    bool is_line_symmetry_h(const uint64_t *blacks, const uint64_t *others) const {
+        for (int y = 0; y < m_cy; ++y) {
+            if (blacks[y] & mirror_row(others[y]))
+                return false;
         }
-        else {
-            ensure(x - 1, y);
-            ensure(x + int(word.size()), y);
+        return true;
+    }
+
+    bool is_line_symmetry_v(const uint64_t *blacks, const uint64_t *others) const {
+        for (int y = 0; y < m_cy; ++y) {
+            if (blacks[y] & others[m_cy - (y + 1)])
+                return false;
         }
+        return true;
     }
 
-    bool rules_ok() const {
-        if (m_rules == 0)
-            return true;
-        if ((m_rules & RULES::DONTDOUBLEBLACK) && double_black())
-            return false;
-        if ((m_rules & RULES::DONTCORNERBLACK) && corner_black())
-            return false;
-        if ((m_rules & RULES::DONTTRIDIRECTIONS) && tri_black_around())
-            return false;
-        if ((m_rules & RULES::DONTTHREEDIAGONALS) && three_diagonals())
-            return false;
-        else if ((m_rules & RULES::DONTFOURDIAGONALS) && four_diagonals())
-            return false;
-        if ((m_rules & RULES::POINTSYMMETRY) && !is_point_symmetry()) {
+    // the black cells in a row through (x, y) going right and down (dx = 1)
+    // or left and down (dx = -1). x, y: absolute coordinate
+    int diagonal_run(int x, int y, int dx) const {
+        if (real_get_at(x, y) != '#')
+            return 0;
+        int run = 1;
+        for (int i = 1; real_get_at(x + i * dx, y + i) == '#'; ++i)
+            ++run;
+        for (int i = 1; real_get_at(x - i * dx, y - i) == '#'; ++i)
+            ++run;
+        return run;
+    }
+
+    // whether an inner cell (x, y) has three or more black neighbours.
+    // x, y: absolute coordinate
+    bool tri_black_at(int x, int y) const {
+        if (x < 1 || m_cx - 2 < x || y < 1 || m_cy - 2 < y)
             return false;
-        } else {
-            if ((m_rules & RULES::LINESYMMETRYH) && !is_line_symmetry_h())
+        return (get_at(x, y - 1) == '#') + (get_at(x, y + 1) == '#') +
+               (get_at(x - 1, y) == '#') + (get_at(x + 1, y) == '#') >= 3;
+    }
+    // whether a neighbour of (x, y) has three or more black neighbours
+    bool tri_black_near(int x, int y) const {
+        return tri_black_at(x, y - 1) || tri_black_at(x, y + 1) ||
+               tri_black_at(x - 1, y) || tri_black_at(x + 1, y);
+    }
+
+    // checks the rules that (x, y) takes part in. on a board that kept the rules,
+    // this is enough after (x, y) changed: a symmetry pair breaks the same way
+    // seen from either cell. DONTDIVIDE is not local.
+    // x, y: absolute coordinate
+    bool rules_ok_at(int x, int y, int rules) const {
+        if (!in_range(x, y))
+            return true;
+        auto ch = get_at(x, y);
+        if (ch == '#') {
+            if ((rules & RULES::DONTCORNERBLACK) && is_corner(x, y))
+                return false;
+            if ((rules & RULES::DONTDOUBLEBLACK) && can_make_double_black(x, y))
+                return false;
+            if ((rules & RULES::DONTTRIDIRECTIONS) && tri_black_near(x, y))
+                return false;
+            if (rules & RULES::DONTTHREEDIAGONALS) {
+                if (diagonal_run(x, y, 1) >= 3 || diagonal_run(x, y, -1) >= 3)
+                    return false;
+            } else if (rules & RULES::DONTFOURDIAGONALS) {
+                if (diagonal_run(x, y, 1) >= 4 || diagonal_run(x, y, -1) >= 4)
+                    return false;
+            }
+        }
+        // a black cell must not face a letter, and vice versa, in every symmetry set
+        if (ch != '?') {
+            if ((rules & RULES::POINTSYMMETRY) &&
+                !mirror_ok(ch, get_at(m_cx - (x + 1), m_cy - (y + 1))))
+            {
                 return false;
-            if ((m_rules & RULES::LINESYMMETRYV) && !is_line_symmetry_v())
+            }
+            if ((rules & RULES::LINESYMMETRYH) && !mirror_ok(ch, get_at(m_cx - (x + 1), y)))
+                return false;
+            if ((rules & RULES::LINESYMMETRYV) && !mirror_ok(ch, get_at(x, m_cy - (y + 1))))
                 return false;
         }
-        if ((m_rules & RULES::DONTDIVIDE) && divided_by_black())
-            return false;
         return true;
     }
+    static bool mirror_ok(t_char ch, t_char mirror) {
+        if (ch == '#')
+            return mirror == '#' || mirror == '?';
+        return mirror != '#';
+    }
+
+    // flood-fills the white cells row by row with shifts. m_cy <= 64.
+    bool divided_by_black(const uint64_t *blacks) const {
+        const uint64_t mask = row_mask();
+        int y0 = 0;
+        while (y0 < m_cy && (~blacks[y0] & mask) == 0)
+            ++y0;
+        if (y0 == m_cy)
+            return false;
+
+        rows_t filled;
+        std::fill(filled.begin(), filled.begin() + m_cy, 0);
+        uint64_t white0 = ~blacks[y0] & mask;
+        filled[y0] = white0 & (~white0 + 1);
+
+        for (bool changed = true; changed; ) {
+            changed = false;
+            // down, then up
+            for (int i = 0; i < 2 * m_cy; ++i) {
+                int y = (i < m_cy) ? i : (2 * m_cy - 1 - i);
+                uint64_t white = ~blacks[y] & mask;
+                uint64_t bits = filled[y];
+                if (y > 0)
+                    bits |= filled[y - 1];
+                if (y + 1 < m_cy)
+                    bits |= filled[y + 1];
+                bits &= white;
+                for (uint64_t old = 0; bits != old; ) {
+                    old = bits;
+                    bits |= ((bits << 1) | (bits >> 1)) & white;
+                }
+                if (bits != filled[y]) {
+                    filled[y] = bits;
+                    changed = true;
+                }
+            }
+        }
+
+        for (int y = 0; y < m_cy; ++y) {
+            if (filled[y] != (~blacks[y] & mask))
+                return true;
+        }
+        return false;
+    }
 
     bool corner_black() const {
         return get_at(0, 0) == '#' ||
@@ -1000,7 +2677,7 @@ skip:;
         }
 
         while (count-- > 0) {
-            if (pb[count] == 0 && get(count) != '#') {
+            if (pb[count] == 0 && get_at(count % m_cx, count / m_cx) != '#') {
                 return true;
             }
         }
@@ -1192,24 +2869,480 @@ skip:;
         assert(b.get_on(0, 2) == '?');
         b.delete_y(0);
         b.m_y0 = 0;
+
+        // a canvas grows and trims in place
+        board_t<t_char, t_fixed> c(1, 1, 'A');
+        c.reserve(2, 1);
+        c.grow_x0(1, '?');
+        c.grow_y1(2, '?');
+        c.grow_x1(3, '?');
+        assert(c.m_cx == 5 && c.m_cy == 3 && c.m_canvas);
+        assert(c.get_on(0, 0) == 'A' && c.get_on(-1, 0) == '?' && c.get_on(3, 2) == '?');
+        c.set_on(2, 1, 'B');
+        int cx, cy;
+        c.get_applied_size({ 3, 0, 0, true }, 3, cx, cy);
+        c.apply_size({ 3, 0, 0, true }, 3);
+        assert(c.m_cx == cx && c.m_cy == cy && c.m_canvas);
+        c.trim();
+        assert(c.m_cx == 3 && c.m_cy == 2 && c.m_canvas);
+        c.compact();
+        assert(!c.m_canvas && c.size() == 6);
+        assert(c.get(0) == 'A' && c.get(5) == 'B' && c.count('?') == 4);
+
+        // the bitmask rules agree with the loops
+        std::mt19937 rng(1);
+        rows_t blacks, others;
+        for (int i = 0; i < 200; ++i) {
+            board_t<t_char, t_fixed> r(1 + rng() % 8, 1 + rng() % 8);
+            for (auto& ch : r.m_data)
+                ch = "#?A"[rng() % 3];
+            r.get_rows(blacks.data(), others.data());
+            assert(r.double_black(blacks.data()) == r.double_black());
+            assert(r.tri_black_around(blacks.data()) == r.tri_black_around());
+            assert(r.three_diagonals(blacks.data()) == r.three_diagonals());
+            assert(r.four_diagonals(blacks.data()) == r.four_diagonals());
+            assert(r.is_point_symmetry(blacks.data(), others.data()) == r.is_point_symmetry());
+            assert(r.is_line_symmetry_h(blacks.data(), others.data()) == r.is_line_symmetry_h());
+            assert(r.is_line_symmetry_v(blacks.data(), others.data()) == r.is_line_symmetry_v());
+            assert(r.divided_by_black(blacks.data()) == r.divided_by_black());
+        }
+
+        // the symmetries combine the same way on the bitmasks and beyond 64 columns
+        for (int cx : { 8, 70 }) {
+            const int point_h = RULES::POINTSYMMETRY | RULES::LINESYMMETRYH;
+            const int point_v = RULES::POINTSYMMETRY | RULES::LINESYMMETRYV;
+            board_t<t_char, t_fixed> r(cx, 3, '?');
+            r.set_at(0, 0, '#');
+            r.set_at(cx - 1, 0, 'A'); // breaks the line symmetry H only
+            r.m_rules = RULES::POINTSYMMETRY;
+            assert(r.rules_ok());
+            r.m_rules = point_h;
+            assert(!r.rules_ok());
+            r.m_rules = point_v;
+            assert(r.rules_ok());
+            r.set_at(cx - 1, 0, '?');
+            r.set_at(cx - 1, 2, 'A'); // breaks the point symmetry only
+            r.m_rules = RULES::LINESYMMETRYH | RULES::LINESYMMETRYV;
+            assert(r.rules_ok());
+            r.m_rules = point_h;
+            assert(!r.rules_ok());
+            r.m_rules = point_v;
+            assert(!r.rules_ok());
+        }
+
+        // after one change, the local check agrees with the whole board
+        const int rule_sets[] = {
+            RULES::DONTDOUBLEBLACK | RULES::DONTCORNERBLACK | RULES::POINTSYMMETRY,
+            RULES::DONTTRIDIRECTIONS | RULES::DONTTHREEDIAGONALS | RULES::LINESYMMETRYV,
+            RULES::DONTFOURDIAGONALS | RULES::LINESYMMETRYH | RULES::LINESYMMETRYV,
+            RULES::DONTDOUBLEBLACK | RULES::POINTSYMMETRY | RULES::LINESYMMETRYH,
+            RULES::POINTSYMMETRY | RULES::LINESYMMETRYH | RULES::LINESYMMETRYV,
+        };
+        for (int i = 0; i < 1000; ++i) {
+            int rules = rule_sets[i % 5];
+            board_t<t_char, t_fixed> r(1 + rng() % 8, 1 + rng() % 8, '?');
+            for (int k = 0; k < 8; ++k) {
+                int x = rng() % r.m_cx, y = rng() % r.m_cy;
+                auto ch = r.get_at(x, y);
+                r.set_at(x, y, "#A"[rng() % 2]);
+                if (!r.rules_ok(rules))
+                    r.set_at(x, y, ch);
+            }
+            int x = rng() % r.m_cx, y = rng() % r.m_cy;
+            r.set_at(x, y, "#A?"[rng() % 3]);
+            assert(r.rules_ok_at(x, y, rules) == r.rules_ok(rules));
+        }
+#endif
+    }
+};
+
+// the state of one generation: the flags, the solution and the threads.
+// the threads refer to the context, so the destructor cancels and joins them.
+// independent contexts can run at once and share a dictionary.
+template <typename t_char, bool t_fixed>
+struct search_context_t {
+    std::atomic<bool> m_generated;
+    std::atomic<bool> m_canceled;
+    std::mutex m_mutex; // guards m_solution and m_running
+    std::condition_variable m_cond; // signaled when done or a thread ends
+    board_t<t_char, t_fixed> m_solution;
+    int m_running; // the threads that have not ended
+    std::vector<std::thread> m_threads;
+    std::atomic<long long> m_jumped; // the levels skipped by backjumping
+
+    search_context_t() : m_generated(false), m_canceled(false), m_running(0), m_jumped(0) { }
+    search_context_t(const search_context_t&) = delete;
+    search_context_t& operator=(const search_context_t&) = delete;
+    ~search_context_t() {
+        cancel();
+    }
+
+    bool is_generated() const {
+        return m_generated.load(std::memory_order_acquire);
+    }
+    bool is_canceled() const {
+        return m_canceled.load(std::memory_order_acquire);
+    }
+    // whether the threads should stop
+    bool is_done() const {
+        return is_canceled() || is_generated();
+    }
+
+    // stops the threads and joins them. don't call it from a search thread.
+    void cancel() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_canceled.store(true, std::memory_order_release);
+        }
+        m_cond.notify_all();
+        join();
+    }
+
+    // keeps the first solution. returns false if another thread was first.
+    bool publish(const board_t<t_char, t_fixed>& board) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_generated.load(std::memory_order_relaxed))
+                return false;
+            m_solution = board;
+            m_generated.store(true, std::memory_order_release);
+        }
+        m_cond.notify_all();
+        return true;
+    }
+
+    // counts a search thread. every enter() needs a leave() at its end.
+    void enter() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_running;
+    }
+    void leave() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_running;
+        }
+        m_cond.notify_all();
+    }
+
+    bool get_solution(board_t<t_char, t_fixed>& board) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_generated.load(std::memory_order_relaxed))
+            return false;
+        board = m_solution;
+        return true;
+    }
+
+    // waits until a solution is published, the search is canceled or all the
+    // threads end. returns whether generated.
+    bool wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return is_done() || m_running == 0; });
+        return is_generated();
+    }
+    // the same as wait() but gives up after timeout
+    template <typename t_rep, typename t_period>
+    bool wait_for(const std::chrono::duration<t_rep, t_period>& timeout) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait_for(lock, timeout, [this] { return is_done() || m_running == 0; });
+        return is_generated();
+    }
+
+    void join() {
+        for (auto& thread : m_threads) {
+            if (thread.joinable())
+                thread.join();
+        }
+        m_threads.clear();
+    }
+
+    // makes the context ready for another generation
+    void reset() {
+        cancel();
+        m_running = 0;
+        m_generated = false;
+        m_canceled = false;
+        m_jumped = 0;
+#ifdef XWORDGIVER
+        for (auto& info : xg_aThreadInfo) {
+            info.m_count = 0;
+        }
 #endif
     }
 };
 
+// the subtrees waiting to be searched. a task is the decision path from the root.
+// each worker pops its newest task and steals the oldest one of the others.
+// a worker without a task sleeps in wait() until a task is pushed or the pool ends.
+template <typename t_decision>
+struct work_pool_t {
+    typedef std::vector<t_decision> task_t;
+    struct deque_t {
+        std::mutex m_mutex;
+        std::deque<task_t> m_tasks;
+    };
+
+    std::vector<std::unique_ptr<deque_t> > m_deques; // m_deques[iworker]
+    std::atomic<int> m_pending; // the tasks queued or running
+    std::atomic<int> m_queued;  // the tasks queued
+    std::atomic<int> m_idle;    // the workers without a task
+    std::atomic<bool> m_stopped;
+    std::mutex m_mutex; // pairs with m_cond
+    std::condition_variable m_cond; // signaled when a task is queued or the pool ends
+
+    work_pool_t(int num_workers) : m_pending(0), m_queued(0), m_idle(0), m_stopped(false) {
+        for (int i = 0; i < num_workers; ++i)
+            m_deques.emplace_back(new deque_t);
+    }
+
+    void push(int iworker, task_t&& task) {
+        ++m_pending;
+        {
+            auto& deque = *m_deques[iworker];
+            std::lock_guard<std::mutex> lock(deque.m_mutex);
+            deque.m_tasks.push_back(std::move(task));
+        }
+        ++m_queued;
+        if (m_idle > 0) {
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            m_cond.notify_one();
+        }
+    }
+
+    bool pop(int iworker, task_t& task) {
+        int num_workers = int(m_deques.size());
+        for (int i = 0; i < num_workers; ++i) {
+            auto& deque = *m_deques[(iworker + i) % num_workers];
+            std::lock_guard<std::mutex> lock(deque.m_mutex);
+            if (deque.m_tasks.empty())
+                continue;
+            if (i == 0) {
+                task = std::move(deque.m_tasks.back());
+                deque.m_tasks.pop_back();
+            } else {
+                task = std::move(deque.m_tasks.front());
+                deque.m_tasks.pop_front();
+            }
+            --m_queued;
+            return true;
+        }
+        return false;
+    }
+
+    bool empty(int iworker) {
+        auto& deque = *m_deques[iworker];
+        std::lock_guard<std::mutex> lock(deque.m_mutex);
+        return deque.m_tasks.empty();
+    }
+
+    // a popped task is done
+    void done() {
+        if (--m_pending == 0)
+            stop();
+    }
+    bool finished() const {
+        return m_pending == 0 || m_stopped;
+    }
+
+    // wakes the waiting workers for good
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cond.notify_all();
+    }
+
+    // sleeps until a task may be popped or the pool ends. the caller counts itself in m_idle.
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return m_queued > 0 || finished(); });
+    }
+};
+
+// the slots of a fixed board.
+// A slot is a run of two or more non-black cells in a row or a column.
+struct slot_graph_t {
+    struct crossing_t {
+        int m_pos;      // the position in this slot
+        int m_slot;     // the crossing slot
+        int m_slot_pos; // the position in the crossing slot
+    };
+    struct slot_t {
+        int m_x, m_y;   // the start cell
+        bool m_vertical;
+        int m_len;
+        std::vector<int> m_cells; // the cell indexes (y * cx + x)
+        std::vector<crossing_t> m_crossings;
+    };
+
+    int m_cx, m_cy;
+    // across in row-major order, then down in column-major order
+    std::vector<slot_t> m_slots;
+    // m_cell_slots[xy]: the across slot and the down slot of the cell, or -1
+    std::vector<std::array<int, 2> > m_cell_slots;
+
+    template <typename t_char>
+    slot_graph_t(const board_t<t_char, true>& board)
+        : m_cx(board.m_cx), m_cy(board.m_cy)
+        , m_cell_slots(size_t(board.m_cx) * board.m_cy, std::array<int, 2>{ { -1, -1 } })
+    {
+        for (int y = 0; y < m_cy; ++y) {
+            for (int x = 0; x < m_cx; ++x) {
+                int x1 = x;
+                while (x1 < m_cx && board.get_at(x1, y) != '#')
+                    ++x1;
+                if (x1 - x >= 2)
+                    add_slot(x, y, false, x1 - x);
+                x = x1;
+            }
+        }
+        for (int x = 0; x < m_cx; ++x) {
+            for (int y = 0; y < m_cy; ++y) {
+                int y1 = y;
+                while (y1 < m_cy && board.get_at(x, y1) != '#')
+                    ++y1;
+                if (y1 - y >= 2)
+                    add_slot(x, y, true, y1 - y);
+                y = y1;
+            }
+        }
+
+        for (auto& slot : m_slots) {
+            for (int pos = 0; pos < slot.m_len; ++pos) {
+                int islot = m_cell_slots[slot.m_cells[pos]][!slot.m_vertical];
+                if (islot < 0)
+                    continue;
+                auto& cells = m_slots[islot].m_cells;
+                int slot_pos = int(std::find(cells.begin(), cells.end(), slot.m_cells[pos]) - cells.begin());
+                slot.m_crossings.push_back({ pos, islot, slot_pos });
+            }
+        }
+    }
+
+    void add_slot(int x, int y, bool vertical, int len) {
+        int islot = int(m_slots.size());
+        slot_t slot = { x, y, vertical, len, {}, {} };
+        for (int i = 0; i < len; ++i) {
+            int xy = vertical ? (y + i) * m_cx + x : y * m_cx + (x + i);
+            slot.m_cells.push_back(xy);
+            m_cell_slots[xy][vertical] = islot;
+        }
+        m_slots.push_back(std::move(slot));
+    }
+};
+
 template <typename t_char, bool t_fixed>
 struct from_words_t {
     typedef std::basic_string<t_char> t_string;
+    typedef std::basic_string_view<t_char> t_string_view;
+    typedef search_context_t<t_char, t_fixed> context_t;
 
-    inline static board_t<t_char, t_fixed> s_solution;
+    context_t *m_context = nullptr;
     board_t<t_char, t_fixed> m_board;
-    std::unordered_set<t_string> m_words, m_dict;
-    std::unordered_set<pos_t> m_crossable_x, m_crossable_y;
+    std::shared_ptr<const dictionary_t<t_char> > m_dict;
+    bitset_t m_words; // the word ids not used yet
+    int m_num_words;  // the number of the word ids not used yet
+    std::vector<int> m_letter_counts; // m_letter_counts[iletter]: the occurrences in the unused words
+    bitgrid_t m_crossable_x, m_crossable_y;
+    trail_t<t_char> m_trail;
+    std::shared_ptr<nogood_table_t> m_nogoods;
+    strategy_t m_strategy;
+    std::mt19937 m_rng;
+    long long m_nodes = 0;   // the nodes visited in this run
+    long long m_budget = -1; // the nodes allowed in this run, or -1
+    bool m_aborted = false;  // whether the budget ran out
     int m_iThread;
 
+    int get_length(const candidate_t<t_char>& cand) const {
+        return (cand.m_word < 0) ? 1 : m_dict->length(cand.m_word);
+    }
+
+    // x, y: relative coordinate
+    void set_cell(int x, int y, t_char ch) {
+        t_char old = m_board.get_on(x, y);
+        if (old == ch)
+            return;
+        m_trail.m_cells.push_back({ x, y, old });
+        m_trail.m_hash ^= zobrist_t::cell(x, y, old) ^ zobrist_t::cell(x, y, ch);
+        m_board.set_on(x, y, ch);
+    }
+    void remove_word(int id) {
+        if (!m_words.test(id))
+            return;
+        m_trail.m_words.push_back(id);
+        m_trail.m_hash ^= zobrist_t::word(id);
+        m_words.reset(id);
+        --m_num_words;
+        count_letters(id, -1);
+    }
+    void count_letters(int id, int delta) {
+        auto word = m_dict->data(id);
+        for (int ich = 0; ich < m_dict->length(id); ++ich) {
+            m_letter_counts[m_dict->letter_index(word[ich])] += delta;
+        }
+    }
+    // x, y: relative coordinate
+    void set_crossable(bool vertical, int x, int y, bool value) {
+        auto& positions = (vertical ? m_crossable_y : m_crossable_x);
+        bool old = positions.test(x, y);
+        if (old == value)
+            return;
+        m_trail.m_flags.push_back({ x, y, vertical, old });
+        m_trail.m_hash ^= zobrist_t::flag(vertical, x, y);
+        positions.assign(x, y, value);
+    }
+
+    void undo(const typename trail_t<t_char>::mark_t& mark) {
+        while (m_trail.m_cells.size() > mark.m_cells) {
+            auto& cell = m_trail.m_cells.back();
+            m_board.set_on(cell.m_x, cell.m_y, cell.m_ch);
+            m_trail.m_cells.pop_back();
+        }
+        while (m_trail.m_words.size() > mark.m_words) {
+            m_words.set(m_trail.m_words.back());
+            ++m_num_words;
+            count_letters(m_trail.m_words.back(), +1);
+            m_trail.m_words.pop_back();
+        }
+        while (m_trail.m_flags.size() > mark.m_flags) {
+            auto& flag = m_trail.m_flags.back();
+            auto& positions = (flag.m_which ? m_crossable_y : m_crossable_x);
+            positions.assign(flag.m_x, flag.m_y, flag.m_value);
+            m_trail.m_flags.pop_back();
+        }
+        m_trail.m_hash = mark.m_hash;
+    }
+
+    // checks the rules around the cells changed since mark
+    bool rules_ok_since(const typename trail_t<t_char>::mark_t& mark) const {
+        int rules = m_board.m_rules & ~RULES::DONTDIVIDE;
+        if (!t_fixed) {
+            // the size and the '?' cells are not final
+            rules &= ~(RULES::DONTCORNERBLACK | RULES::POINTSYMMETRY |
+                       RULES::LINESYMMETRYV | RULES::LINESYMMETRYH);
+        }
+        if (rules == 0)
+            return true;
+        for (size_t i = mark.m_cells; i < m_trail.m_cells.size(); ++i) {
+            auto& cell = m_trail.m_cells[i];
+            if (!m_board.rules_ok_at(cell.m_x - m_board.m_x0, cell.m_y - m_board.m_y0, rules))
+                return false;
+        }
+        assert(m_board.rules_ok(rules));
+        return true;
+    }
+
     bool apply_candidate(const candidate_t<t_char>& cand) {
-        auto& word = cand.m_word;
-        m_words.erase(word);
         int x = cand.m_x, y = cand.m_y;
+        t_char letter;
+        t_string_view word;
+        if (cand.m_word < 0) {
+            letter = m_board.get_on(x, y);
+            word = t_string_view(&letter, 1);
+        } else {
+            word = t_string_view(m_dict->data(cand.m_word), m_dict->length(cand.m_word));
+            remove_word(cand.m_word);
+        }
         if (cand.m_vertical) {
             if (t_fixed) {
                 if (!m_board.ensure_y(y) || !m_board.ensure_y(y + int(word.size()) - 1))
@@ -1218,14 +3351,14 @@ struct from_words_t {
                 m_board.ensure(x, y - 1);
                 m_board.ensure(x, y + int(word.size()));
             }
-            m_board.set_on(x, y - 1, '#');
-            m_board.set_on(x, y + int(word.size()), '#');
+            set_cell(x, y - 1, '#');
+            set_cell(x, y + int(word.size()), '#');
             for (size_t ich = 0; ich < word.size(); ++ich) {
                 int y0 = y + int(ich);
-                m_board.set_on(x, y0, word[ich]);
-                m_crossable_y.erase({x, y0});
+                set_cell(x, y0, word[ich]);
+                set_crossable(true, x, y0, false);
                 if (m_board.is_crossable_x(x, y0))
-                    m_crossable_x.insert({ x, y0 });
+                    set_crossable(false, x, y0, true);
             }
         } else {
             if (t_fixed) {
@@ -1235,14 +3368,14 @@ struct from_words_t {
                 m_board.ensure(x - 1, y);
                 m_board.ensure(x + int(word.size()), y);
             }
-            m_board.set_on(x - 1, y, '#');
-            m_board.set_on(x + int(word.size()), y, '#');
+            set_cell(x - 1, y, '#');
+            set_cell(x + int(word.size()), y, '#');
             for (size_t ich = 0; ich < word.size(); ++ich) {
                 int x0 = x + int(ich);
-                m_board.set_on(x0, y, word[ich]);
-                m_crossable_x.erase({x0, y});
+                set_cell(x0, y, word[ich]);
+                set_crossable(false, x0, y, false);
                 if (m_board.is_crossable_y(x0, y))
-                    m_crossable_y.insert({ x0, y });
+                    set_crossable(true, x0, y, true);
             }
         }
         return true;
@@ -1258,42 +3391,42 @@ struct from_words_t {
         t_char ch1 = m_board.get_on(x - 1, y);
         t_char ch2 = m_board.get_on(x + 1, y);
         if (!is_letter(ch1) && !is_letter(ch2)) {
-            t_char sz[2] = { ch0, 0 };
-            cands.push_back({ x, y, sz, false });
+            cands.push_back({ x, y, -1, false });
         }
 
-        for (auto& word : m_words) {
-            if (s_canceled || s_generated) {
+        auto entries = m_dict->find_letter(ch0);
+        for (auto entry = entries.first; entry != entries.second; ++entry) {
+            if (m_context->is_done()) {
                 cands.clear();
                 return cands;
             }
 
-            for (size_t ich = 0; ich < word.size(); ++ich) {
-                if (word[ich] != ch0)
-                    continue;
+            if (!m_words.test(entry->m_word))
+                continue;
 
-                int x0 = x - int(ich);
-                int x1 = x0 + int(word.size());
-                bool matched = true;
-                if (matched) {
-                    t_char ch1 = m_board.get_on(x0 - 1, y);
-                    t_char ch2 = m_board.get_on(x1, y);
-                    if (is_letter(ch1) || is_letter(ch2)) {
-                        matched = false;
-                    }
+            auto word = m_dict->data(entry->m_word);
+            int len = m_dict->length(entry->m_word);
+            int x0 = x - int(entry->m_offset);
+            int x1 = x0 + len;
+            bool matched = true;
+            if (matched) {
+                t_char ch1 = m_board.get_on(x0 - 1, y);
+                t_char ch2 = m_board.get_on(x1, y);
+                if (is_letter(ch1) || is_letter(ch2)) {
+                    matched = false;
                 }
-                if (matched) {
-                    for (size_t k = 0; k < word.size(); ++k) {
-                        t_char ch3 = m_board.get_on(x0 + int(k), y);
-                        if (ch3 != '?' && word[k] != ch3) {
-                            matched = false;
-                            break;
-                        }
+            }
+            if (matched) {
+                for (int k = 0; k < len; ++k) {
+                    t_char ch3 = m_board.get_on(x0 + int(k), y);
+                    if (ch3 != '?' && word[k] != ch3) {
+                        matched = false;
+                        break;
                     }
                 }
-                if (matched) {
-                    cands.push_back({x0, y, word, false});
-                }
+            }
+            if (matched) {
+                cands.push_back({ x0, y, int(entry->m_word), false });
             }
         }
 
@@ -1310,42 +3443,42 @@ struct from_words_t {
         t_char ch1 = m_board.get_on(x, y - 1);
         t_char ch2 = m_board.get_on(x, y + 1);
         if (!is_letter(ch1) && !is_letter(ch2)) {
-            t_char sz[2] = { ch0, 0 };
-            cands.push_back({ x, y, sz, true });
+            cands.push_back({ x, y, -1, true });
         }
 
-        for (auto& word : m_words) {
-            if (s_canceled || s_generated) {
+        auto entries = m_dict->find_letter(ch0);
+        for (auto entry = entries.first; entry != entries.second; ++entry) {
+            if (m_context->is_done()) {
                 cands.clear();
                 return cands;
             }
 
-            for (size_t ich = 0; ich < word.size(); ++ich) {
-                if (word[ich] != ch0)
-                    continue;
+            if (!m_words.test(entry->m_word))
+                continue;
 
-                int y0 = y - int(ich);
-                int y1 = y0 + int(word.size());
-                bool matched = true;
-                if (matched) {
-                    t_char ch1 = m_board.get_on(x, y0 - 1);
-                    t_char ch2 = m_board.get_on(x, y1);
-                    if (is_letter(ch1) || is_letter(ch2)) {
-                        matched = false;
-                    }
+            auto word = m_dict->data(entry->m_word);
+            int len = m_dict->length(entry->m_word);
+            int y0 = y - int(entry->m_offset);
+            int y1 = y0 + len;
+            bool matched = true;
+            if (matched) {
+                t_char ch1 = m_board.get_on(x, y0 - 1);
+                t_char ch2 = m_board.get_on(x, y1);
+                if (is_letter(ch1) || is_letter(ch2)) {
+                    matched = false;
                 }
-                if (matched) {
-                    for (size_t k = 0; k < word.size(); ++k) {
-                        t_char ch3 = m_board.get_on(x, y0 + int(k));
-                        if (ch3 != '?' && word[k] != ch3) {
-                            matched = false;
-                            break;
-                        }
+            }
+            if (matched) {
+                for (int k = 0; k < len; ++k) {
+                    t_char ch3 = m_board.get_on(x, y0 + int(k));
+                    if (ch3 != '?' && word[k] != ch3) {
+                        matched = false;
+                        break;
                     }
                 }
-                if (matched) {
-                    cands.push_back({x, y0, word, true});
-                }
+            }
+            if (matched) {
+                cands.push_back({ x, y0, int(entry->m_word), true });
             }
         }
 
@@ -1356,53 +3489,96 @@ struct from_words_t {
         std::vector<candidate_t<t_char> > cands;
         std::unordered_set<pos_t> positions;
         for (auto& cand : candidates) {
-            if (s_canceled || s_generated)
-                return s_generated;
-            if (cand.m_word.size() == 1) {
+            if (m_context->is_done())
+                return m_context->is_generated();
+            if (get_length(cand) == 1) {
                 cands.push_back(cand);
                 positions.insert( {cand.m_x, cand.m_y} );
             }
         }
         for (auto& cand : candidates) {
-            if (s_canceled || s_generated)
-                return s_generated;
-            if (cand.m_word.size() != 1) {
+            if (m_context->is_done())
+                return m_context->is_generated();
+            if (get_length(cand) != 1) {
                 if (positions.count(pos_t(cand.m_x, cand.m_y)) == 0)
                     return false;
             }
         }
         for (auto& cand : cands) {
-            if (s_canceled || s_generated)
-                return s_generated;
+            if (m_context->is_done())
+                return m_context->is_generated();
             apply_candidate(cand);
         }
         return true;
     }
 
-    bool generate_recurse() {
-        if (s_canceled || s_generated)
-            return s_generated;
+    // the options that cand leaves: the occurrences of its new letters in the unused words
+    int get_score(const candidate_t<t_char>& cand) const {
+        if (cand.m_word < 0)
+            return 0;
+        auto word = m_dict->data(cand.m_word);
+        int score = 0;
+        for (int ich = 0; ich < m_dict->length(cand.m_word); ++ich) {
+            int x = cand.m_vertical ? cand.m_x : cand.m_x + ich;
+            int y = cand.m_vertical ? cand.m_y + ich : cand.m_y;
+            if (is_letter(m_board.get_on(x, y)))
+                continue;
+            score += m_letter_counts[m_dict->letter_index(word[ich])];
+        }
+        return score;
+    }
 
-        if (s_generated)
-            return true;
+    void order_candidates(std::vector<candidate_t<t_char> >& candidates) {
+        crossword_generation::random_shuffle(candidates.begin(), candidates.end(), m_rng);
+        if (m_strategy.m_value_order != VALUE_ORDER::LCV)
+            return;
+
+        std::vector<std::pair<int, candidate_t<t_char> > > scored;
+        scored.reserve(candidates.size());
+        for (auto& cand : candidates) {
+            scored.emplace_back(get_score(cand), cand);
+        }
+        std::stable_sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+        for (size_t i = 0; i < scored.size(); ++i) {
+            candidates[i] = scored[i].second;
+        }
+    }
+
+    bool generate_recurse() {
+        if (m_context->is_done())
+            return m_context->is_generated();
 
         if (m_crossable_x.empty() && m_crossable_y.empty())
             return false;
 
+        if (m_nogoods && m_nogoods->contains(m_trail.m_hash))
+            return false;
+
+        if (m_budget >= 0 && ++m_nodes > m_budget) {
+            m_aborted = true;
+            return false;
+        }
+
 #ifdef XWORDGIVER
-        xg_aThreadInfo[m_iThread].m_count = int(m_dict.size() - m_words.size());
+        xg_aThreadInfo[m_iThread].m_count = m_dict->size() - m_num_words;
 #endif
 
         std::vector<candidate_t<t_char> > candidates;
-
-        for (auto& cross : m_crossable_x) {
-            if (s_canceled || s_generated)
-                return s_generated;
+        std::vector<pos_t> crosses;
+
+        m_crossable_x.for_each([&](int x, int y) {
+            crosses.emplace_back(x, y);
+        });
+        for (auto& cross : crosses) {
+            if (m_context->is_done())
+                return m_context->is_generated();
             auto cands = get_candidates_x(cross.m_x, cross.m_y);
             if (cands.empty()) {
                 if (m_board.must_be_cross(cross.m_x, cross.m_y))
                     return false;
-            } else if (cands.size() == 1 && cands[0].m_word.size() == 1) {
+            } else if (cands.size() == 1 && get_length(cands[0]) == 1) {
                 if (m_board.must_be_cross(cross.m_x, cross.m_y))
                     return false;
             } else {
@@ -1410,14 +3586,18 @@ struct from_words_t {
             }
         }
 
-        for (auto& cross : m_crossable_y) {
-            if (s_canceled || s_generated)
-                return s_generated;
+        crosses.clear();
+        m_crossable_y.for_each([&](int x, int y) {
+            crosses.emplace_back(x, y);
+        });
+        for (auto& cross : crosses) {
+            if (m_context->is_done())
+                return m_context->is_generated();
             auto cands = get_candidates_y(cross.m_x, cross.m_y);
             if (cands.empty()) {
                 if (m_board.must_be_cross(cross.m_x, cross.m_y))
                     return false;
-            } else if (cands.size() == 1 && cands[0].m_word.size() == 1) {
+            } else if (cands.size() == 1 && get_length(cands[0]) == 1) {
                 if (m_board.must_be_cross(cross.m_x, cross.m_y))
                     return false;
             } else {
@@ -1425,56 +3605,58 @@ struct from_words_t {
             }
         }
 
-        if (m_words.empty()) {
+        if (m_num_words == 0) {
             if (fixup_candidates(candidates)) {
                 board_t<t_char, t_fixed> board0 = m_board;
                 board0.trim();
+                board0.compact();
                 board0.replace('?', '#');
                 if (is_solution(board0)) {
-                    std::lock_guard<std::mutex> lock(s_mutex);
-                    s_generated = true;
-                    s_solution = board0;
+                    m_context->publish(board0);
                     return true;
                 }
             }
-            return s_generated;
+            return m_context->is_generated();
         }
 
 #ifdef XWORDGIVER
-        if (m_dict.size() <= 50 && m_words.size() < m_dict.size() / 2 && !t_fixed) {
+        if (m_dict->size() <= 50 && m_num_words < m_dict->size() / 2 && !t_fixed) {
             std::sort(candidates.begin(), candidates.end(),
                 [&](const candidate_t<t_char>& cand0, const candidate_t<t_char>& cand1) {
-                    board_t<t_char, false> board0 = m_board;
-                    board0.apply_size(cand0);
-                    board_t<t_char, false> board1 = m_board;
-                    board1.apply_size(cand1);
-                    int cxy0 = (board0.m_cx + board0.m_cy) + std::abs(board0.m_cy - board0.m_cx) / 4;
-                    int cxy1 = (board1.m_cx + board1.m_cy) + std::abs(board1.m_cy - board1.m_cx) / 4;
+                    int cx0, cy0, cx1, cy1;
+                    m_board.get_applied_size(cand0, get_length(cand0), cx0, cy0);
+                    m_board.get_applied_size(cand1, get_length(cand1), cx1, cy1);
+                    int cxy0 = (cx0 + cy0) + std::abs(cy0 - cx0) / 4;
+                    int cxy1 = (cx1 + cy1) + std::abs(cy1 - cx1) / 4;
                     return cxy0 < cxy1;
                 }
             );
         } else {
-            crossword_generation::random_shuffle(candidates.begin(), candidates.end());
+            order_candidates(candidates);
         }
 #else
-        crossword_generation::random_shuffle(candidates.begin(), candidates.end());
+        order_candidates(candidates);
 #endif
 
         for (auto& cand : candidates) {
-            if (s_canceled || s_generated)
-                return s_generated;
-            from_words_t<t_char, t_fixed> copy(*this);
-            if (copy.apply_candidate(cand) && copy.generate_recurse()) {
+            if (m_context->is_done() || m_aborted)
+                return m_context->is_generated();
+            auto mark = m_trail.mark();
+            if (apply_candidate(cand) && rules_ok_since(mark) && generate_recurse()) {
                 return true;
             }
+            undo(mark);
         }
 
+        // fully explored
+        if (m_nogoods && !m_context->is_done() && !m_aborted)
+            m_nogoods->insert(m_trail.m_hash);
         return false;
     }
 
     bool check_used_words(const board_t<t_char, t_fixed>& board) const
     {
-        std::unordered_set<t_string> used;
+        std::unordered_set<int> used;
 
         for (int y = board.m_y0; y < board.m_y0 + board.m_cy; ++y) {
             for (int x = board.m_x0; x < board.m_x0 + board.m_cx - 1; ++x) {
@@ -1492,10 +3674,11 @@ struct from_words_t {
                             break;
                         word += ch1;
                     }
-                    if (used.count(word) > 0 || m_dict.count(word) == 0) {
+                    int id = m_dict->find(word);
+                    if (id < 0 || used.count(id) > 0) {
                         return false;
                     }
-                    used.insert(word);
+                    used.insert(id);
                 }
             }
         }
@@ -1516,15 +3699,16 @@ struct from_words_t {
                             break;
                         word += ch1;
                     }
-                    if (used.count(word) > 0 || m_dict.count(word) == 0) {
+                    int id = m_dict->find(word);
+                    if (id < 0 || used.count(id) > 0) {
                         return false;
                     }
-                    used.insert(word);
+                    used.insert(id);
                 }
             }
         }
 
-        return used.size() == m_dict.size();
+        return int(used.size()) == m_dict->size();
     }
 
     bool is_solution(const board_t<t_char, t_fixed>& board) const {
@@ -1536,50 +3720,96 @@ struct from_words_t {
     }
 
     bool generate() {
-        if (m_words.empty())
+        if (m_num_words == 0)
             return false;
 
-        auto word = *m_words.begin();
-        candidate_t<t_char> cand = { 0, 0, word, false };
-        apply_candidate(cand);
-        if (!generate_recurse())
+        // start from the longest word
+        candidate_t<t_char> cand = { 0, 0, m_dict->size() - 1, false };
+        auto mark = m_trail.mark();
+        if (!apply_candidate(cand) || !rules_ok_since(mark))
             return false;
 
-        return true;
+        // restart with a new budget until a run completes
+        auto base = m_trail.mark();
+        for (int irestart = 1; !m_context->is_done(); ++irestart) {
+            m_nodes = 0;
+            m_budget = m_strategy.get_budget(irestart);
+            m_aborted = false;
+            if (generate_recurse())
+                return true;
+            if (!m_aborted)
+                break;
+            undo(base);
+        }
+
+        return m_context->is_generated();
     }
 
-    static bool generate_proc(const std::unordered_set<t_string> *words, int iThread) {
+    static bool
+    generate_proc(context_t *context, std::shared_ptr<const dictionary_t<t_char> > dict,
+                  int iThread, strategy_t strategy, uint64_t salt)
+    {
         std::srand(uint32_t(::GetTickCount64()) ^ ::GetCurrentThreadId());
 #ifdef _WIN32
         ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
 #endif
         from_words_t<t_char, t_fixed> data;
+        data.m_context = context;
         data.m_iThread = iThread;
-        data.m_words = *words;
-        data.m_dict = std::move(*words);
-        delete words;
-        return data.generate();
+        data.m_dict = std::move(dict);
+        data.m_board.m_rules = strategy.m_rules;
+        if (!t_fixed && data.m_dict->size()) {
+            // a canvas for about sqrt(n) words across, and it grows if needed
+            int max_len = data.m_dict->length(data.m_dict->size() - 1);
+            int across = int(std::ceil(std::sqrt(double(data.m_dict->size()))));
+            int margin = std::min(max_len * across + 2, 128);
+            data.m_board.reserve(margin, margin);
+        }
+        data.m_words.resize(data.m_dict->size(), true);
+        data.m_num_words = data.m_dict->size();
+        data.m_letter_counts.assign(data.m_dict->num_letters(), 0);
+        for (int id = 0; id < data.m_dict->size(); ++id)
+            data.count_letters(id, +1);
+        data.m_strategy = strategy.get_variant(iThread);
+        data.m_rng.seed(strategy.get_seed(iThread));
+        data.m_nogoods = strategy.m_nogoods;
+        data.m_trail.m_hash = salt;
+        bool ret = data.generate();
+        context->leave();
+        return ret;
     }
 
+    // starts the threads of context. context must outlive them.
+    // NOTE: The threads share dict. Don't modify it while generating.
     static bool
-    do_generate(const std::unordered_set<t_string>& words,
-                int num_threads = get_num_processors())
+    do_generate(context_t& context, std::shared_ptr<const dictionary_t<t_char> > dict,
+                int num_threads = get_num_processors(),
+                strategy_t strategy = strategy_t())
     {
+        context.reset();
+        uint64_t salt = (strategy.m_nogoods ? strategy.m_nogoods->new_salt() : 0);
 #ifdef SINGLETHREADDEBUG
-        auto clone = new std::unordered_set<t_string>(words);
-        generate_proc(clone, 0);
+        context.enter();
+        generate_proc(&context, dict, 0, strategy, salt);
 #else
         for (int i = 0; i < num_threads; ++i) {
-            auto clone = new std::unordered_set<t_string>(words);
+            context.enter();
             try {
-                std::thread t(generate_proc, clone, i);
-                t.detach();
+                context.m_threads.emplace_back(generate_proc, &context, dict, i, strategy, salt);
             } catch (std::system_error&) {
-                delete clone;
+                context.leave();
             }
         }
 #endif
-        return s_generated;
+        return context.is_generated();
+    }
+    static bool
+    do_generate(context_t& context, const std::unordered_set<t_string>& words,
+                int num_threads = get_num_processors(),
+                strategy_t strategy = strategy_t())
+    {
+        return do_generate(context, std::make_shared<const dictionary_t<t_char> >(words),
+                           num_threads, strategy);
     }
 }; // struct from_words_t
 
@@ -1587,267 +3817,936 @@ template <typename t_char>
 struct non_add_block_t {
     typedef std::basic_string<t_char> t_string;
     enum { t_fixed = 1 };
+    typedef search_context_t<t_char, t_fixed> context_t;
+
+    struct decision_t {
+        int m_slot, m_word;
+    };
+    typedef work_pool_t<decision_t> pool_t;
+
+    context_t *m_context = nullptr;
+    // an open node of the search
+    struct frame_t {
+        int m_slot;
+        std::vector<int> m_cands;
+        size_t m_next;   // the next candidate to try
+        bool m_complete; // false if candidates were donated
+    };
 
-    inline static board_t<t_char, t_fixed> s_solution;
     board_t<t_char, t_fixed> m_board;
-    std::unordered_set<t_string> m_words, m_dict;
-    std::unordered_set<pos_t> m_checked_x, m_checked_y;
+    std::shared_ptr<const dictionary_t<t_char> > m_dict;
+    std::shared_ptr<const slot_graph_t> m_graph;
+    bitset_t m_words;        // the word ids not used yet
+    bitset_t m_checked;      // the slots known to be valid words
+    std::vector<int> m_filled; // m_filled[islot]: the number of the letters in the slot
+    std::vector<bitset_t> m_domains; // m_domains[islot]: the candidate words, indexed from first(len)
+    std::vector<bitset_t> m_masks;   // m_masks[xy]: the letters allowed at a crossing cell
+    // the levels that pruned m_domains[islot], then m_masks[xy] at [num_slots + xy]
+    std::vector<bitset_t> m_conflicts;
+    bitset_t m_failure; // the levels responsible for the last wipeout
+    int m_level;        // the current decision level, or -1
+    long long m_jumped;
+    bitset_t m_scratch_mask, m_scratch_domain; // the work bits of revise and use_word
+    // the bits displaced by undo, kept to be the next scratch bits
+    std::vector<bitset_t> m_spare_masks, m_spare_domains;
+    trail_t<t_char> m_trail;
+    std::shared_ptr<nogood_table_t> m_nogoods;
+    std::shared_ptr<pool_t> m_pool;
+    std::vector<decision_t> m_path; // the decisions of the current task
+    std::vector<frame_t> m_frames;
+    strategy_t m_strategy;
+    std::mt19937 m_rng;
+    long long m_nodes = 0;   // the nodes visited in this run
+    long long m_budget = -1; // the nodes allowed in this run, or -1
+    bool m_aborted = false;  // whether the budget ran out
     int m_iThread;
 
-    std::vector<candidate_t<t_char>>
-    get_candidates_from_pat(int x, int y, const t_string& pat, bool vertical) const {
-        std::vector<candidate_t<t_char>> ret;
-        assert(pat.size() > 0);
-        if (pat.find('?') == pat.npos) {
-            if (m_words.count(pat) > 0)
-                ret.push_back({ x, y, pat, vertical });
-            return ret;
+    void set_cell(int xy, t_char ch) {
+        t_char old = m_board.get(xy);
+        if (old == ch)
+            return;
+        assert(old == '?' && is_letter(ch));
+        int x = xy % m_board.m_cx, y = xy / m_board.m_cx;
+        m_trail.m_cells.push_back({ x, y, old });
+        m_trail.m_hash ^= zobrist_t::cell(x, y, ch);
+        m_board.set(xy, ch);
+        for (auto islot : m_graph->m_cell_slots[xy]) {
+            if (islot >= 0)
+                ++m_filled[islot];
         }
-        ret.reserve(m_words.size() >> 4);
-        for (auto& word : m_words) {
-            if (word.size() != pat.size())
-                continue;
-            bool matched = true;
-            for (size_t ich = 0; ich < word.size(); ++ich) {
-                if (pat[ich] != '?' && pat[ich] != word[ich]) {
-                    matched = false;
-                    break;
-                }
+    }
+    void remove_word(int id) {
+        if (!m_words.test(id))
+            return;
+        m_trail.m_words.push_back(id);
+        m_trail.m_hash ^= zobrist_t::word(id);
+        m_words.reset(id);
+    }
+    void set_checked(int islot) {
+        if (m_checked.test(islot))
+            return;
+        m_trail.m_slots.push_back(islot);
+        m_checked.set(islot);
+    }
+    // takes the bits of scratch and leaves it a spare buffer
+    void set_domain(int islot, bitset_t& scratch) {
+        m_trail.m_domains.push_back({ islot, std::move(m_domains[islot]) });
+        m_domains[islot] = std::move(scratch);
+        take_spare(scratch, m_spare_domains);
+    }
+    void set_mask(int xy, bitset_t& scratch) {
+        m_trail.m_masks.push_back({ xy, std::move(m_masks[xy]) });
+        m_masks[xy] = std::move(scratch);
+        take_spare(scratch, m_spare_masks);
+    }
+    static void take_spare(bitset_t& scratch, std::vector<bitset_t>& spares) {
+        if (spares.empty())
+            return;
+        scratch = std::move(spares.back());
+        spares.pop_back();
+    }
+
+    bool is_backjumping() const {
+        return m_strategy.m_backjump && m_strategy.m_lookahead != LOOKAHEAD::NONE;
+    }
+    int get_mask_conflict(int xy) const {
+        return int(m_graph->m_slots.size()) + xy;
+    }
+    // adds the levels of src and the current level to the conflict set at index
+    void add_conflict(int index, const bitset_t *src) {
+        if (!is_backjumping())
+            return;
+        bitset_t conflict = m_conflicts[index];
+        if (src)
+            conflict |= *src;
+        if (m_level >= 0)
+            conflict.set(m_level);
+        if (conflict == m_conflicts[index])
+            return;
+        m_trail.m_conflicts.push_back({ index, std::move(m_conflicts[index]) });
+        m_conflicts[index] = std::move(conflict);
+    }
+    bool fail(int index) {
+        if (is_backjumping())
+            m_failure = m_conflicts[index];
+        return false;
+    }
+
+    void undo(const typename trail_t<t_char>::mark_t& mark) {
+        while (m_trail.m_cells.size() > mark.m_cells) {
+            auto& cell = m_trail.m_cells.back();
+            int xy = cell.m_y * m_board.m_cx + cell.m_x;
+            m_board.set(xy, cell.m_ch);
+            for (auto islot : m_graph->m_cell_slots[xy]) {
+                if (islot >= 0)
+                    --m_filled[islot];
             }
-            if (matched)
-                ret.push_back({ x, y, word, vertical});
+            m_trail.m_cells.pop_back();
+        }
+        while (m_trail.m_words.size() > mark.m_words) {
+            m_words.set(m_trail.m_words.back());
+            m_trail.m_words.pop_back();
         }
+        while (m_trail.m_slots.size() > mark.m_slots) {
+            m_checked.reset(m_trail.m_slots.back());
+            m_trail.m_slots.pop_back();
+        }
+        while (m_trail.m_domains.size() > mark.m_domains) {
+            auto& entry = m_trail.m_domains.back();
+            m_spare_domains.push_back(std::move(m_domains[entry.m_index]));
+            m_domains[entry.m_index] = std::move(entry.m_bits);
+            m_trail.m_domains.pop_back();
+        }
+        while (m_trail.m_masks.size() > mark.m_masks) {
+            auto& entry = m_trail.m_masks.back();
+            m_spare_masks.push_back(std::move(m_masks[entry.m_index]));
+            m_masks[entry.m_index] = std::move(entry.m_bits);
+            m_trail.m_masks.pop_back();
+        }
+        while (m_trail.m_conflicts.size() > mark.m_conflicts) {
+            auto& entry = m_trail.m_conflicts.back();
+            m_conflicts[entry.m_index] = std::move(entry.m_bits);
+            m_trail.m_conflicts.pop_back();
+        }
+        m_trail.m_hash = mark.m_hash;
+    }
+
+    void get_pat(int islot, t_string& pat) const {
+        auto& slot = m_graph->m_slots[islot];
+        pat.resize(slot.m_cells.size());
+        for (size_t ich = 0; ich < slot.m_cells.size(); ++ich) {
+            pat[ich] = m_board.get(slot.m_cells[ich]);
+        }
+    }
+
+    bool is_partial(int islot) const {
+        return 0 < m_filled[islot] && m_filled[islot] < m_graph->m_slots[islot].m_len;
+    }
+
+    // the unused words that fit the slot
+    std::vector<int> get_candidates(int islot) const {
+        std::vector<int> ret;
+        if (m_strategy.m_lookahead != LOOKAHEAD::NONE) {
+            int first = m_dict->first(m_graph->m_slots[islot].m_len);
+            m_domains[islot].for_each([&](size_t iword) {
+                ret.push_back(first + int(iword));
+            });
+            return ret;
+        }
+        t_string pat;
+        get_pat(islot, pat);
+        if (m_filled[islot] == int(pat.size())) {
+            int id = m_dict->find(pat);
+            if (id >= 0 && m_words.test(id))
+                ret.push_back(id);
+            return ret;
+        }
+        auto fn = [&](int id) {
+            ret.push_back(id);
+        };
+        if (m_strategy.m_matcher == MATCHER::TRIE)
+            m_dict->match_trie(pat, m_words, fn);
+        else
+            m_dict->match(pat, m_words, fn);
         return ret;
     }
 
+    // whether any unused word fits pat
+    bool any_candidate(const t_string& pat) const {
+        if (m_strategy.m_matcher == MATCHER::TRIE)
+            return m_dict->any_match_trie(pat, m_words);
+        return m_dict->any_match(pat, m_words);
+    }
+
+    // a complete slot must be a word, and a partial slot must be fillable
+    bool check_slot(int islot) {
+        if (m_checked.test(islot) || m_filled[islot] == 0)
+            return true;
+
+        t_string pat;
+        get_pat(islot, pat);
+        if (m_filled[islot] < int(pat.size()))
+            return any_candidate(pat);
+
+        if (m_dict->find(pat) < 0)
+            return false;
+        set_checked(islot);
+        return true;
+    }
+
     bool check_words() {
-        for (int y = 0; y < m_board.m_cy; ++y) {
-            for (int x = 0; x < m_board.m_cx; ++x) {
-                if (m_checked_x.count(pos_t(x, y)) > 0)
-                    continue;
+        for (int islot = 0; islot < int(m_graph->m_slots.size()); ++islot) {
+            if (!check_slot(islot))
+                return false;
+        }
+        return true;
+    }
 
-                int x0;
-                auto pat = m_board.get_pat_x(x, y, &x0);
-                if (pat.find('?') != pat.npos)
-                    continue;
+    // checks the slots crossing islot
+    bool check_crossings(int islot) {
+        for (auto& crossing : m_graph->m_slots[islot].m_crossings) {
+            if (!check_slot(crossing.m_slot))
+                return false;
+        }
+        return true;
+    }
 
-                if (pat.size() <= 1) {
-                    m_checked_x.emplace(x, y);
-                    continue;
-                }
+    void apply_word(int islot, int id) {
+        auto& slot = m_graph->m_slots[islot];
+        auto word = m_dict->data(id);
+        remove_word(id);
+        set_checked(islot);
+        for (size_t ich = 0; ich < slot.m_cells.size(); ++ich) {
+            set_cell(slot.m_cells[ich], word[ich]);
+        }
+    }
 
-                if (m_dict.count(pat) == 0)
-                    return false;
+    static void enqueue(std::vector<int>& queue, int islot) {
+        if (std::find(queue.begin(), queue.end(), islot) == queue.end())
+            queue.push_back(islot);
+    }
 
-                for (size_t i = 0; i < pat.size(); ++i, ++x0) {
-                    m_checked_x.emplace(x0, y);
-                }
+    // drops the letters at the crossing cell that the domain of islot doesn't support,
+    // then the words of the crossing slot that the remaining letters don't allow.
+    // returns false if a mask or a domain becomes empty.
+    bool revise(int islot, const slot_graph_t::crossing_t& crossing, bool& changed) {
+        auto& slot = m_graph->m_slots[islot];
+        auto& other = m_graph->m_slots[crossing.m_slot];
+        int xy = slot.m_cells[crossing.m_pos];
+        changed = false;
+
+        const bitset_t& domain = m_domains[islot];
+        bitset_t& mask = m_scratch_mask;
+        mask = m_masks[xy];
+        bool dropped = false;
+        m_masks[xy].for_each([&](size_t iletter) {
+            if (!domain.intersects(m_dict->pat_bits(slot.m_len, crossing.m_pos, int(iletter)))) {
+                mask.reset(iletter);
+                dropped = true;
             }
-        }
+        });
+        if (!dropped)
+            return true;
+        add_conflict(get_mask_conflict(xy), &m_conflicts[islot]);
+        if (!mask.any())
+            return fail(get_mask_conflict(xy));
+
+        bitset_t& allowed = m_scratch_domain;
+        allowed.resize(m_domains[crossing.m_slot].size());
+        mask.for_each([&](size_t iletter) {
+            allowed |= m_dict->pat_bits(other.m_len, crossing.m_slot_pos, int(iletter));
+        });
+        set_mask(xy, mask);
+        allowed &= m_domains[crossing.m_slot];
+        if (allowed == m_domains[crossing.m_slot])
+            return true;
+        add_conflict(crossing.m_slot, &m_conflicts[get_mask_conflict(xy)]);
+        if (!allowed.any())
+            return fail(crossing.m_slot);
+        set_domain(crossing.m_slot, allowed);
+        changed = true;
+        return true;
+    }
 
-        for (int x = 0; x < m_board.m_cx; ++x) {
-            for (int y = 0; y < m_board.m_cy; ++y) {
-                if (m_checked_y.count(pos_t(x, y)) > 0)
-                    continue;
+    // uses up id for islot. the other slots of the same length lose it.
+    bool use_word(int islot, int id, std::vector<int>& queue) {
+        auto& slots = m_graph->m_slots;
+        int len = slots[islot].m_len, iword = id - m_dict->first(len);
+        remove_word(id);
+        set_checked(islot);
+        if (m_domains[islot].count() != 1) {
+            bitset_t& domain = m_scratch_domain;
+            domain.resize(m_domains[islot].size());
+            domain.set(iword);
+            set_domain(islot, domain);
+            add_conflict(islot, nullptr);
+        }
+        enqueue(queue, islot);
 
-                int y0;
-                auto pat = m_board.get_pat_y(x, y, &y0);
-                if (pat.find('?') != pat.npos)
-                    continue;
+        for (int jslot = 0; jslot < int(slots.size()); ++jslot) {
+            if (jslot == islot || slots[jslot].m_len != len || !m_domains[jslot].test(iword))
+                continue;
+            bitset_t& domain = m_scratch_domain;
+            domain = m_domains[jslot];
+            domain.reset(iword);
+            add_conflict(jslot, &m_conflicts[islot]);
+            if (!domain.any())
+                return fail(jslot);
+            set_domain(jslot, domain);
+            if (m_strategy.m_lookahead == LOOKAHEAD::AC3)
+                enqueue(queue, jslot);
+        }
+        return true;
+    }
 
-                if (pat.size() <= 1) {
-                    m_checked_y.emplace(x, y);
-                    continue;
+    // revises the crossings of the slots in queue. AC3 queues the changed slots in turn.
+    bool propagate(std::vector<int>& queue) {
+        auto& slots = m_graph->m_slots;
+        for (;;) {
+            while (!queue.empty()) {
+                int islot = queue.back();
+                queue.pop_back();
+                for (auto& crossing : slots[islot].m_crossings) {
+                    bool changed;
+                    if (!revise(islot, crossing, changed))
+                        return false;
+                    if (changed && m_strategy.m_lookahead == LOOKAHEAD::AC3)
+                        enqueue(queue, crossing.m_slot);
                 }
+            }
 
-                if (m_dict.count(pat) == 0)
+            // the slots that the crossings completed use up their words
+            for (int islot = 0; islot < int(slots.size()); ++islot) {
+                if (m_checked.test(islot) || m_filled[islot] < slots[islot].m_len)
+                    continue;
+                assert(m_domains[islot].count() == 1);
+                int iword = -1;
+                m_domains[islot].for_each([&](size_t i) { iword = int(i); });
+                if (!use_word(islot, m_dict->first(slots[islot].m_len) + iword, queue))
                     return false;
+            }
+            if (queue.empty())
+                return true;
+        }
+    }
 
-                for (size_t i = 0; i < pat.size(); ++i, ++y0) {
-                    m_checked_y.emplace(x, y0);
-                }
+    // builds the domains and the masks and makes them consistent
+    bool init_domains() {
+        auto& slots = m_graph->m_slots;
+        m_domains.assign(slots.size(), bitset_t());
+        m_masks.assign(m_board.m_cx * m_board.m_cy, bitset_t());
+        m_conflicts.assign(slots.size() + m_masks.size(), bitset_t(slots.size() + 1));
+        m_failure.resize(slots.size() + 1);
+        m_scratch_mask.resize(m_dict->num_letters());
+        m_scratch_domain.resize(m_dict->size()); // no domain is larger
+        std::vector<int> queue;
+        t_string pat;
+        for (int islot = 0; islot < int(slots.size()); ++islot) {
+            get_pat(islot, pat);
+            if (!m_dict->match_bits(pat, m_words, m_domains[islot]))
+                return fail(islot);
+            for (auto& crossing : slots[islot].m_crossings) {
+                int xy = slots[islot].m_cells[crossing.m_pos];
+                if (m_masks[xy].size() == 0)
+                    m_masks[xy].resize(m_dict->num_letters(), true);
             }
+            queue.push_back(islot);
         }
+        return propagate(queue);
+    }
 
-        return true;
+    // places id in islot, then checks or prunes the crossing slots
+    bool assign(int islot, int id) {
+        apply_word(islot, id);
+        if (m_strategy.m_lookahead == LOOKAHEAD::NONE)
+            return check_crossings(islot);
+        std::vector<int> queue;
+        return use_word(islot, id, queue) && propagate(queue);
     }
 
-    bool apply_candidate_x(const candidate_t<t_char>& cand) {
-        auto& word = cand.m_word;
-        m_words.erase(word);
-        int x = cand.m_x, y = cand.m_y;
-        for (size_t ich = 0; ich < word.size(); ++ich, ++x) {
-            m_checked_x.emplace(x, y);
-            m_board.set_at(x, y, word[ich]);
+    // the number of the unused words that fit the slot
+    int count_candidates(int islot) const {
+        if (m_strategy.m_lookahead != LOOKAHEAD::NONE)
+            return int(m_domains[islot].count());
+        t_string pat;
+        get_pat(islot, pat);
+        bitset_t bits;
+        if (!m_dict->match_bits(pat, m_words, bits))
+            return 0;
+        return int(bits.count());
+    }
+
+    int choose_slot() const {
+        auto& slots = m_graph->m_slots;
+        if (m_strategy.m_slot_order == SLOT_ORDER::ROW_MAJOR) {
+            // the first partial slot, across in row-major order then down in column-major order
+            for (int islot = 0; islot < int(slots.size()); ++islot) {
+                if (is_partial(islot))
+                    return islot;
+            }
+            return -1;
         }
-        return true;
+
+        // the unfilled slot with the fewest candidates, then with the most crossings
+        int ret = -1, best_count = 0;
+        for (int islot = 0; islot < int(slots.size()); ++islot) {
+            if (m_filled[islot] == slots[islot].m_len)
+                continue;
+            int count = count_candidates(islot);
+            if (ret < 0 || count < best_count ||
+                (count == best_count &&
+                 slots[islot].m_crossings.size() > slots[ret].m_crossings.size()))
+            {
+                ret = islot;
+                best_count = count;
+                if (count == 0)
+                    break;
+            }
+        }
+        return ret;
     }
-    bool apply_candidate_y(const candidate_t<t_char>& cand) {
-        auto& word = cand.m_word;
-        m_words.erase(word);
-        int x = cand.m_x, y = cand.m_y;
-        for (size_t ich = 0; ich < word.size(); ++ich, ++y) {
-            m_checked_y.emplace(x, y);
-            m_board.set_at(x, y, word[ich]);
+
+    // shuffles cands. LCV puts first the ones leaving the most words to the crossing slots.
+    void order_candidates(int islot, std::vector<int>& cands) {
+        crossword_generation::random_shuffle(cands.begin(), cands.end(), m_rng);
+        if (m_strategy.m_value_order != VALUE_ORDER::LCV || cands.size() <= 1)
+            return;
+
+        // counts[icrossing * num_letters + iletter]: the words left to the crossing slot
+        auto& slot = m_graph->m_slots[islot];
+        int num_letters = m_dict->num_letters();
+        std::vector<int> counts(slot.m_crossings.size() * num_letters, 0);
+        bitset_t bits;
+        t_string pat;
+        for (size_t icrossing = 0; icrossing < slot.m_crossings.size(); ++icrossing) {
+            auto& crossing = slot.m_crossings[icrossing];
+            auto& other = m_graph->m_slots[crossing.m_slot];
+            if (m_filled[crossing.m_slot] == other.m_len)
+                continue;
+            const bitset_t *domain = &bits;
+            if (m_strategy.m_lookahead != LOOKAHEAD::NONE) {
+                domain = &m_domains[crossing.m_slot];
+            } else {
+                get_pat(crossing.m_slot, pat);
+                if (!m_dict->match_bits(pat, m_words, bits))
+                    continue;
+            }
+            for (int iletter = 0; iletter < num_letters; ++iletter) {
+                auto letter_bits = m_dict->pat_bits(other.m_len, crossing.m_slot_pos, iletter);
+                counts[icrossing * num_letters + iletter] = int(domain->count_and(letter_bits));
+            }
+        }
+
+        std::vector<std::pair<int, int> > scored; // (score, id)
+        scored.reserve(cands.size());
+        for (auto id : cands) {
+            auto word = m_dict->data(id);
+            int score = 0;
+            for (size_t icrossing = 0; icrossing < slot.m_crossings.size(); ++icrossing) {
+                int iletter = m_dict->letter_index(word[slot.m_crossings[icrossing].m_pos]);
+                score += counts[icrossing * num_letters + iletter];
+            }
+            scored.emplace_back(score, id);
+        }
+        std::stable_sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+        for (size_t i = 0; i < scored.size(); ++i) {
+            cands[i] = scored[i].second;
         }
-        return true;
     }
 
-    bool generate_recurse() {
-        if (s_canceled || s_generated || !check_words())
-            return s_generated;
-
-        for (int y = 0; y < m_board.m_cy; ++y) {
-            for (int x = 0; x < m_board.m_cx - 1; ++x) {
-                if (s_canceled || s_generated)
-                    return s_generated;
-
-                t_char ch0 = m_board.get_at(x, y);
-                t_char ch1 = m_board.get_at(x + 1, y);
-                if ((is_letter(ch0) && ch1 == '?') || (ch0 == '?' && is_letter(ch1))) {
-                    int x0;
-                    auto pat = m_board.get_pat_x(x, y, &x0);
-                    auto cands = get_candidates_from_pat(x0, y, pat, false);
-                    if (cands.empty())
-                        return false;
-                    crossword_generation::random_shuffle(cands.begin(), cands.end());
-                    for (auto& cand : cands) {
-                        if (s_canceled || s_generated)
-                            return s_generated;
-
-                        non_add_block_t<t_char> copy(*this);
-                        copy.apply_candidate_x(cand);
-                        if (copy.generate_recurse())
-                            break;
-                    }
-                    return s_generated;
-                }
+    // gives the untried candidates of the shallowest open node to the pool
+    void donate() {
+        for (size_t iframe = 0; iframe < m_frames.size(); ++iframe) {
+            auto& frame = m_frames[iframe];
+            if (frame.m_next >= frame.m_cands.size())
+                continue;
+
+            auto path = m_path;
+            for (size_t i = 0; i < iframe; ++i) {
+                path.push_back({ m_frames[i].m_slot, m_frames[i].m_cands[m_frames[i].m_next - 1] });
+            }
+            for (size_t i = frame.m_next; i < frame.m_cands.size(); ++i) {
+                auto task = path;
+                task.push_back({ frame.m_slot, frame.m_cands[i] });
+                m_pool->push(m_iThread, std::move(task));
             }
+            frame.m_cands.resize(frame.m_next);
+            for (size_t i = 0; i <= iframe; ++i) {
+                m_frames[i].m_complete = false;
+            }
+            return;
         }
+    }
 
-        for (int x = 0; x < m_board.m_cx; ++x) {
-            for (int y = 0; y < m_board.m_cy - 1; ++y) {
-                if (s_canceled || s_generated)
-                    return s_generated;
+    // level: the decision level of this node.
+    // conflict: the levels responsible for the failure, if backjumping.
+    bool generate_recurse(int level, bitset_t& conflict) {
+        if (m_context->is_done())
+            return m_context->is_generated();
 
-                t_char ch0 = m_board.get_at(x, y);
-                t_char ch1 = m_board.get_at(x, y + 1);
-                if ((is_letter(ch0) && ch1 == '?') || (ch0 == '?' && is_letter(ch1))) {
-                    int y0;
-                    auto pat = m_board.get_pat_y(x, y, &y0);
-                    auto cands = get_candidates_from_pat(x, y0, pat, true);
-                    if (cands.empty())
-                        return false;
-                    crossword_generation::random_shuffle(cands.begin(), cands.end());
-                    for (auto& cand : cands) {
-                        if (s_canceled || s_generated)
-                            return s_generated;
-
-                        non_add_block_t<t_char> copy(*this);
-                        copy.apply_candidate_y(cand);
-                        if (copy.generate_recurse())
-                            break;
+        bool backjumping = is_backjumping();
+        if (m_nogoods && m_nogoods->contains(m_trail.m_hash)) {
+            if (backjumping)
+                conflict.resize(m_failure.size(), true);
+            return false;
+        }
+
+        if (m_budget >= 0 && ++m_nodes > m_budget) {
+            m_aborted = true;
+            if (backjumping)
+                conflict.resize(m_failure.size(), true);
+            return false;
+        }
+
+        if (m_pool && m_pool->m_idle > 0 && m_pool->empty(m_iThread))
+            donate();
+
+        int islot = choose_slot();
+        if (islot >= 0) {
+            if (backjumping)
+                conflict = m_conflicts[islot]; // the levels that pruned the slot
+            auto cands = get_candidates(islot);
+            if (cands.empty())
+                return false;
+            order_candidates(islot, cands);
+
+            size_t iframe = m_frames.size();
+            m_frames.push_back({ islot, std::move(cands), 0, true });
+            bitset_t sub(m_failure.size());
+            bool jumped = false;
+            while (m_frames[iframe].m_next < m_frames[iframe].m_cands.size()) {
+                if (m_context->is_done() || m_aborted)
+                    break;
+
+                int id = m_frames[iframe].m_cands[m_frames[iframe].m_next++];
+                auto mark = m_trail.mark();
+                m_level = level;
+                if (assign(islot, id)) {
+                    if (generate_recurse(level + 1, sub))
+                        break;
+                } else if (backjumping) {
+                    sub = m_failure;
+                }
+                undo(mark);
+
+                if (backjumping) {
+                    if (!sub.test(level)) {
+                        // this level is not responsible. jump back.
+                        if (m_frames[iframe].m_next < m_frames[iframe].m_cands.size())
+                            ++m_jumped;
+                        conflict = std::move(sub);
+                        jumped = true;
+                        break;
                     }
-                    return s_generated;
+                    sub.reset(level);
+                    conflict |= sub;
                 }
             }
+            bool complete = m_frames[iframe].m_complete && !m_aborted;
+            m_frames.pop_back();
+
+            if (!complete) {
+                // the donated or the skipped candidates prove nothing
+                if (backjumping && !jumped)
+                    conflict.resize(m_failure.size(), true);
+            } else if (!jumped && m_nogoods && !m_context->is_done()) {
+                // fully explored
+                m_nogoods->insert(m_trail.m_hash);
+            }
+            return m_context->is_generated();
         }
 
         if (is_solution(m_board)) {
-            std::lock_guard<std::mutex> lock(s_mutex);
-            s_generated = true;
-            s_solution = m_board;
+            m_context->publish(m_board);
             return true;
         }
 
-        return s_generated;
+        // blame all the levels
+        conflict.resize(m_failure.size(), true);
+        return m_context->is_generated();
     }
 
     bool is_solution(const board_t<t_char, t_fixed>& board) {
         return (board.count('?') == 0);
     }
 
-    bool generate() {
-        if (m_words.empty())
+    // makes the domains or checks the given letters
+    bool prepare() {
+        if (m_dict->size() == 0)
             return false;
 
         assert(m_board.rules_ok());
 
-        if (m_board.has_letter())
-            return generate_recurse();
-
-        std::vector<t_string> words(m_words.begin(), m_words.end());
-        crossword_generation::random_shuffle(words.begin(), words.end());
-
-        for (int y = 0; y < m_board.m_cy; ++y) {
-            for (int x = 0; x < m_board.m_cx - 1; ++x) {
-                if (s_canceled || s_generated)
-                    return s_generated;
-                if (m_board.get_at(x, y) == '?' && m_board.get_at(x + 1, y) == '?') {
-                    int x0;
-                    auto pat = m_board.get_pat_x(x, y, &x0);
-                    auto cands = get_candidates_from_pat(x0, y, pat, false);
-                    for (auto& cand : cands) {
-                        if (s_canceled || s_generated)
-                            return s_generated;
-
-                        non_add_block_t<t_char> copy(*this);
-                        copy.apply_candidate_x(cand);
-                        if (copy.generate_recurse())
-                            return true;
-                    }
-                    x += int(pat.size());
-                }
+        if (m_strategy.m_lookahead != LOOKAHEAD::NONE)
+            return init_domains();
+        return !m_board.has_letter() || check_words();
+    }
+
+    bool generate_root() {
+        bitset_t conflict(m_failure.size());
+        if (m_board.has_letter() || m_strategy.m_slot_order == SLOT_ORDER::MRV)
+            return generate_recurse(0, conflict);
+
+        for (int islot = 0; islot < int(m_graph->m_slots.size()); ++islot) {
+            if (m_context->is_done())
+                return m_context->is_generated();
+            if (m_graph->m_slots[islot].m_vertical)
+                break;
+
+            auto cands = get_candidates(islot);
+            for (auto id : cands) {
+                if (m_context->is_done() || m_aborted)
+                    return m_context->is_generated();
+
+                auto mark = m_trail.mark();
+                m_level = 0;
+                m_path.push_back({ islot, id });
+                if (assign(islot, id) && generate_recurse(1, conflict))
+                    return true;
+                m_path.pop_back();
+                undo(mark);
             }
         }
 
         return false;
     }
 
+    bool generate() {
+        if (!prepare())
+            return false;
+
+        // restart with a new budget until a run completes
+        auto base = m_trail.mark();
+        for (int irestart = 1; !m_context->is_done(); ++irestart) {
+            m_nodes = 0;
+            m_budget = m_strategy.get_budget(irestart);
+            m_aborted = false;
+            if (generate_root())
+                return true;
+            if (!m_aborted)
+                break;
+            undo(base);
+        }
+
+        return m_context->is_generated();
+    }
+
+    // replays the decisions of task, then searches the subtree
+    bool run_task(const typename pool_t::task_t& task) {
+        if (task.empty())
+            return generate_root();
+
+        m_level = -1;
+        for (auto& decision : task) {
+            if (!assign(decision.m_slot, decision.m_word))
+                return false;
+        }
+        m_path = task;
+        bitset_t conflict(m_failure.size());
+        return generate_recurse(0, conflict);
+    }
+
+    // runs the tasks of m_pool until none is left
+    bool work() {
+        if (!prepare())
+            return false;
+
+        auto base = m_trail.mark();
+        typename pool_t::task_t task;
+        bool idle = false;
+        while (!m_context->is_done() && !m_pool->finished()) {
+            if (!m_pool->pop(m_iThread, task)) {
+                if (!idle) {
+                    idle = true;
+                    ++m_pool->m_idle;
+                    continue; // look again, now that a push would signal us
+                }
+                m_pool->wait();
+                continue;
+            }
+            if (idle) {
+                idle = false;
+                --m_pool->m_idle;
+            }
+            run_task(task);
+            m_path.clear();
+            undo(base);
+            m_pool->done();
+        }
+        if (idle)
+            --m_pool->m_idle;
+        // solved, canceled or exhausted. the sleeping workers must see it.
+        m_pool->stop();
+        return m_context->is_generated();
+    }
+
+    // salt: the initial hash, which keeps the nogoods of the calls apart
     static bool
-    generate_proc(board_t<t_char, t_fixed> *pboard,
-                  std::unordered_set<t_string> *pwords, int iThread)
+    generate_proc(context_t *context, board_t<t_char, t_fixed> *pboard,
+                  std::shared_ptr<const slot_graph_t> graph,
+                  std::shared_ptr<const dictionary_t<t_char> > dict, int iThread,
+                  strategy_t strategy, uint64_t salt, std::shared_ptr<pool_t> pool)
     {
         std::srand(uint32_t(::GetTickCount64()) ^ ::GetCurrentThreadId());
 #ifdef _WIN32
         //::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
 #endif
         non_add_block_t<t_char> data;
+        data.m_context = context;
         data.m_iThread = iThread;
         data.m_board = std::move(*pboard);
         delete pboard;
-        data.m_words = *pwords;
-        data.m_dict = std::move(*pwords);
-        delete pwords;
-        return data.generate();
+        data.m_graph = std::move(graph);
+        data.m_checked.resize(data.m_graph->m_slots.size());
+        data.m_filled.resize(data.m_graph->m_slots.size());
+        for (auto& slot : data.m_graph->m_slots) {
+            for (auto xy : slot.m_cells) {
+                if (is_letter(data.m_board.get(xy)))
+                    ++data.m_filled[&slot - data.m_graph->m_slots.data()];
+            }
+        }
+        data.m_dict = std::move(dict);
+        data.m_words.resize(data.m_dict->size(), true);
+        data.m_strategy = strategy.get_variant(iThread);
+        data.m_rng.seed(strategy.get_seed(iThread));
+        data.m_nogoods = strategy.m_nogoods;
+        data.m_trail.m_hash = salt ^ zobrist_t::lookahead(data.m_strategy.m_lookahead);
+        data.m_pool = std::move(pool);
+        data.m_level = -1;
+        data.m_jumped = 0;
+        bool ret = (data.m_pool ? data.work() : data.generate());
+        context->m_jumped += data.m_jumped;
+        context->leave();
+        return ret;
+    }
+
+    // the pool of a parallel search, with the root task.
+    // a portfolio or restarts run the threads independently instead.
+    static std::shared_ptr<pool_t> make_pool(int num_threads, const strategy_t& strategy) {
+        if (num_threads <= 1 || strategy.m_portfolio || strategy.m_restart != RESTART::NONE)
+            return nullptr;
+        auto pool = std::make_shared<pool_t>(num_threads);
+        pool->push(0, typename pool_t::task_t());
+        return pool;
     }
 
+    // starts the threads of context. context must outlive them.
+    // NOTE: The threads share dict. Don't modify it while generating.
     static bool
-    do_generate(const board_t<t_char, t_fixed>& board,
-                const std::unordered_set<t_string>& words,
-                int num_threads = get_num_processors())
+    do_generate(context_t& context, const board_t<t_char, t_fixed>& board,
+                std::shared_ptr<const dictionary_t<t_char> > dict,
+                int num_threads = get_num_processors(),
+                strategy_t strategy = strategy_t())
     {
+        context.reset();
         board_t<t_char, t_fixed> *pboard = nullptr;
-        std::unordered_set<t_string> *pwords = nullptr;
+        auto graph = std::make_shared<const slot_graph_t>(board); // the threads share it
+        uint64_t salt = (strategy.m_nogoods ? strategy.m_nogoods->new_salt() : 0);
 #ifdef SINGLETHREADDEBUG
         pboard = new board_t<t_char, t_fixed>(board);
-        pwords = new std::unordered_set<t_string>(words);
-        generate_proc(pboard, pwords, 0);
+        context.enter();
+        generate_proc(&context, pboard, graph, dict, 0, strategy, salt, nullptr);
 #else
+        auto pool = make_pool(num_threads, strategy);
         for (int i = 0; i < num_threads; ++i) {
             pboard = new board_t<t_char, t_fixed>(board);
-            pwords = new std::unordered_set<t_string>(words);
+            context.enter();
             try {
-                std::thread t(generate_proc, pboard, pwords, i);
-                t.detach();
+                context.m_threads.emplace_back(generate_proc, &context, pboard, graph, dict, i,
+                                               strategy, salt, pool);
             } catch (std::system_error&) {
+                context.leave();
                 delete pboard;
-                delete pwords;
             }
         }
 #endif
-        return s_generated;
+        return context.is_generated();
+    }
+    static bool
+    do_generate(context_t& context, const board_t<t_char, t_fixed>& board,
+                const std::unordered_set<t_string>& words,
+                int num_threads = get_num_processors(),
+                strategy_t strategy = strategy_t())
+    {
+        return do_generate(context, board, std::make_shared<const dictionary_t<t_char> >(words),
+                           num_threads, strategy);
     }
 }; // struct non_add_block_t
 
+// runs many fill jobs on one set of threads that lives as long as the batch.
+// each job is searched by a single thread, so the jobs run side by side.
+// the threads share one nogood table across jobs; the keys are salted per job.
+// NOTE: The jobs share their dictionaries. Don't modify them while generating.
+template <typename t_char>
+struct batch_t {
+    typedef non_add_block_t<t_char> engine_t;
+    typedef typename engine_t::context_t context_t;
+
+    struct job_t {
+        board_t<t_char, true> m_board; // the template
+        std::shared_ptr<const dictionary_t<t_char> > m_dict;
+        strategy_t m_strategy;
+    };
+    struct result_t {
+        size_t m_index; // the order of submit
+        bool m_generated;
+        board_t<t_char, true> m_solution;
+    };
+
+    std::mutex m_mutex; // guards the members below
+    std::condition_variable m_cond_jobs; // signaled when a job is queued or stopping
+    std::condition_variable m_cond_results; // signaled when a result is queued
+    std::deque<std::pair<size_t, job_t> > m_jobs;
+    std::deque<result_t> m_results;
+    std::vector<context_t*> m_running; // the contexts of the running jobs
+    size_t m_submitted = 0;
+    size_t m_reported = 0; // the results taken by get_result
+    bool m_stopping = false;
+    std::shared_ptr<nogood_table_t> m_nogoods; // for the jobs without their own
+    std::vector<std::thread> m_threads;
+
+    // nogood_bytes: the memory cap of the nogood table of all the threads. 0 for none.
+    batch_t(int num_threads = get_num_processors(), size_t nogood_bytes = 0) {
+        if (nogood_bytes)
+            m_nogoods = std::make_shared<nogood_table_t>(nogood_bytes);
+
+        for (int i = 0; i < num_threads; ++i) {
+            try {
+                m_threads.emplace_back(&batch_t::worker, this);
+            } catch (std::system_error&) {
+                ;
+            }
+        }
+    }
+    batch_t(const batch_t&) = delete;
+    batch_t& operator=(const batch_t&) = delete;
+    ~batch_t() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        cancel();
+        m_cond_jobs.notify_all();
+        for (auto& thread : m_threads)
+            thread.join();
+    }
+
+    // queues a job. returns its index.
+    size_t submit(job_t job) {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            index = m_submitted++;
+            m_jobs.emplace_back(index, std::move(job));
+        }
+        m_cond_jobs.notify_one();
+        return index;
+    }
+
+    // waits for the next result in the order of completion.
+    // returns false if every job has been reported.
+    bool get_result(result_t& result) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond_results.wait(lock, [this] {
+            return !m_results.empty() || m_reported == m_submitted;
+        });
+        if (m_results.empty())
+            return false;
+        result = std::move(m_results.front());
+        m_results.pop_front();
+        ++m_reported;
+        return true;
+    }
+
+    // gives up the queued and the running jobs. they are reported as not generated.
+    void cancel() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& job : m_jobs)
+                m_results.push_back({ job.first, false, board_t<t_char, true>() });
+            m_jobs.clear();
+            for (auto context : m_running)
+                context->m_canceled.store(true, std::memory_order_release);
+        }
+        m_cond_results.notify_all();
+    }
+
+    void worker() {
+        for (;;) {
+            std::pair<size_t, job_t> job;
+            context_t context;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond_jobs.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+                if (m_stopping)
+                    return;
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+                m_running.push_back(&context);
+            }
+
+            auto& strategy = job.second.m_strategy;
+            if (!strategy.m_nogoods)
+                strategy.m_nogoods = m_nogoods;
+            uint64_t salt = (strategy.m_nogoods ? strategy.m_nogoods->new_salt() : 0);
+            auto graph = std::make_shared<const slot_graph_t>(job.second.m_board);
+            context.enter();
+            engine_t::generate_proc(&context, new board_t<t_char, true>(std::move(job.second.m_board)),
+                                    std::move(graph), std::move(job.second.m_dict), 0, strategy,
+                                    salt, nullptr);
+
+            result_t result = { job.first, false, board_t<t_char, true>() };
+            result.m_generated = context.get_solution(result.m_solution);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running.erase(std::find(m_running.begin(), m_running.end(), &context));
+                m_results.push_back(std::move(result));
+            }
+            m_cond_results.notify_all();
+        }
+    }
+}; // struct batch_t
+
 } // namespace crossword_generation
@@ -0,0 +1,37 @@
+// load_dict.hpp --- loads a text dictionary, one word per line
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+
+template <typename T_CHAR>
+inline void mstr_trim(std::basic_string<T_CHAR>& str, const T_CHAR *spaces)
+{
+    typedef std::basic_string<T_CHAR> string_type;
+    size_t i = str.find_first_not_of(spaces);
+    size_t j = str.find_last_not_of(spaces);
+    if ((i == string_type::npos) || (j == string_type::npos))
+    {
+        str.clear();
+    }
+    else
+    {
+        str = str.substr(i, j - i + 1);
+    }
+}
+
+inline bool load_dict(const char *filename, std::unordered_set<std::string>& dict) {
+    if (FILE *fp = fopen(filename, "r")) {
+        char buf[256];
+        while (fgets(buf, 256, fp)) {
+            std::string str = buf;
+            mstr_trim(str, " \t\r\n");
+            if (str.size())
+                dict.insert(str);
+        }
+        fclose(fp);
+        return true;
+    }
+    return false;
+}
@@ -2,51 +2,28 @@
 //#define NO_RANDOM
 
 #include "crossword_generation.hpp"
+#include "load_dict.hpp"
 
 std::unordered_set<std::string> s_words;
-
-template <typename T_CHAR>
-inline void mstr_trim(std::basic_string<T_CHAR>& str, const T_CHAR *spaces)
-{
-    typedef std::basic_string<T_CHAR> string_type;
-    size_t i = str.find_first_not_of(spaces);
-    size_t j = str.find_last_not_of(spaces);
-    if ((i == string_type::npos) || (j == string_type::npos))
-    {
-        str.clear();
-    }
-    else
-    {
-        str = str.substr(i, j - i + 1);
-    }
-}
-
-bool load_dict(const char *filename, std::unordered_set<std::string>& dict) {
-    if (FILE *fp = fopen(filename, "r")) {
-        char buf[256];
-        while (fgets(buf, 256, fp)) {
-            std::string str = buf;
-            mstr_trim(str, " \t\r\n");
-            dict.insert(str);
-        }
-        return true;
-    }
-    return false;
-}
+std::shared_ptr<const crossword_generation::dictionary_t<char> > s_dict;
 
 void do_test1(void) {
     using namespace crossword_generation;
+    if (s_words.empty()) {
+        // loaded from a binary dictionary
+        for (int id = 0; id < s_dict->size(); ++id)
+            s_words.insert(s_dict->str(id));
+    }
     std::string nonconnected;
     if (!check_connectivity<char>(s_words, nonconnected)) {
         std::printf("check_connectivity failed: %s\n\n", nonconnected.c_str());
     } else {
-        reset();
-        from_words_t<char, false>::do_generate(s_words);
-        wait_for_threads(1);
-        if (s_generated) {
-            s_mutex.lock();
-            from_words_t<char, false>::s_solution.print();
-            s_mutex.unlock();
+        from_words_t<char, false>::context_t context;
+        board_t<char, false> solution;
+        from_words_t<char, false>::do_generate(context, s_words);
+        context.wait_for(std::chrono::milliseconds(100));
+        if (context.get_solution(solution)) {
+            solution.print();
         } else {
             std::printf("failed\n");
         }
@@ -56,7 +33,6 @@ void do_test1(void) {
 #if 1
 void do_test2(void) {
     using namespace crossword_generation;
-    reset();
 
     board_t<char, true> board(6, 6, '?');
     board.m_data =
@@ -67,14 +43,17 @@ void do_test2(void) {
 "#?#?#?"
 "#?????";
 
+    // the retries share one nogood table
+    strategy_t strategy;
+    strategy.m_nogoods = std::make_shared<nogood_table_t>(16 * 1024 * 1024);
+
     for (int i = 0; i < 5; ++i) {
-        reset();
-        non_add_block_t<char>::do_generate(board, s_words);
-        wait_for_threads(1, 10);
-        if (s_generated) {
-            s_mutex.lock();
-            non_add_block_t<char>::s_solution.print();
-            s_mutex.unlock();
+        non_add_block_t<char>::context_t context;
+        board_t<char, true> solution;
+        non_add_block_t<char>::do_generate(context, board, s_dict, get_num_processors(), strategy);
+        context.wait_for(std::chrono::seconds(1));
+        if (context.get_solution(solution)) {
+            solution.print();
             break;
         }
         else {
@@ -85,15 +64,20 @@ void do_test2(void) {
 #endif
 
 int main(int argc, char **argv) {
-    std::srand(DWORD(::GetTickCount64()) ^ ::GetCurrentThreadId());
+    std::srand(uint32_t(::GetTickCount64()) ^ ::GetCurrentThreadId());
 
     using namespace crossword_generation;
     board_t<char, false>::unittest();
+    dictionary_t<char>::unittest();
+    connectivity_unittest<char>();
+    nogood_table_t::unittest();
 
     if (argc > 1) {
         s_words.clear();
         if (argc == 2) {
-            if (!load_dict(argv[1], s_words)) {
+            // a binary dictionary by compile_dict, or a text file
+            s_dict = dictionary_t<char>::load(argv[1]);
+            if (!s_dict && !load_dict(argv[1], s_words)) {
                 std::fprintf(stderr, "ERROR: cannot load file '%s'\n", argv[1]);
                 return EXIT_FAILURE;
             }
@@ -104,7 +88,7 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (s_words.empty()) {
+    if (!s_dict && s_words.empty()) {
         auto name = "dict.txt";
         if (!load_dict(name, s_words)) {
             std::fprintf(stderr, "ERROR: cannot load file '%s'\n", name );
@@ -112,6 +96,9 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (!s_dict)
+        s_dict = std::make_shared<const dictionary_t<char> >(s_words);
+
     auto t0 = std::time(NULL);
 #if 0
     do_test1();